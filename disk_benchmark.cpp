@@ -13,13 +13,61 @@
 #include <cstdlib>
 #include <iomanip>
 #include <array>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <functional>
+#include <climits> // IOV_MAX
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#include <cerrno>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#ifdef __APPLE__
+#include <sys/param.h>
+#include <sys/mount.h> // statfs
+#else
+#include <sys/vfs.h> // statfs
+#endif
+#ifdef __linux__
+#include <sys/sysmacros.h> // major, minor
+#endif
 #include <fcntl.h>
 #include <unistd.h> // unlink
-#include "matplotlibcpp.h"
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h> // FICLONE, FS_IOC_FIEMAP
+#include <linux/fiemap.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#ifdef RWF_NOWAIT
+#define HAVE_PREADV2
+#endif
+#include <sched.h> // sched_setaffinity
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#define HAVE_PERF_EVENT
+#endif
+#if __has_include(<linux/mempolicy.h>)
+#include <linux/mempolicy.h> // MPOL_BIND, no libnuma needed
+#define HAVE_MEMPOLICY
+#endif
+#endif
 
 namespace fs = std::filesystem;
-namespace plt = matplotlibcpp;
 
 using namespace std;
 using namespace chrono;
@@ -152,16 +200,163 @@ int unmount_ramdisk(bool verbose) {
     return 0;
 }
 
-enum class Func { ReadWrite, PReadWrite, FStream, MMap };
+// Without hdiutil (Linux) the RAM disk is a directory on a memory filesystem,
+// which needs no privileges: tmpfs in /dev/shm, or hugetlbfs on request.
+// hugetlbfs files can only be mapped, so it serves the mmap engine only.
+const string RAMDISK_TMPFS = "/dev/shm";
+
+// Mount point of a hugetlbfs filesystem, empty if there is none
+string find_hugetlbfs() {
+    ifstream mounts("/proc/mounts");
+    string device, path, type, rest;
+    while (mounts >> device >> path >> type && getline(mounts, rest)) {
+        if (type == "hugetlbfs" && access(path.c_str(), W_OK) == 0) {
+            return path;
+        }
+    }
+    return "";
+}
+
+int create_memory_ramdisk(bool verbose, bool huge, string &mount_path) {
+    string base = huge ? find_hugetlbfs() : RAMDISK_TMPFS;
+    if (base.empty()) {
+        return DISK_NOT_FOUND;
+    }
+    mount_path = base + "/" + VOLUME_NAME + "_" + to_string(getpid());
+    if (mkdir(mount_path.c_str(), 0755) != 0) {
+        perror("mkdir");
+        return FAILED_CREATE;
+    }
+    if (verbose) {
+        cout << "RAM disk created at path: " << mount_path << endl;
+    }
+    return 0;
+}
+
+int remove_memory_ramdisk(bool verbose, const string &mount_path) {
+    if (rmdir(mount_path.c_str()) != 0) {
+        perror("rmdir");
+        return ERROR_EJECTING;
+    }
+    if (is_ramdisk_mounted(mount_path)) {
+        return RAMDISK_STILL_EXISTS;
+    }
+    if (verbose) {
+        cout << "RAM disk successfully removed." << endl;
+    }
+    return 0;
+}
+
+constexpr int MAX_TRIALS = 100; // adaptive stopping gives up here
+
+enum class Func { ReadWrite, PReadWrite, FStream, MMap, Uring, PReadWriteV };
+
+enum class Pattern { Sequential, Random, Zipf, Hotspot };
+
+enum class MsyncMode { Block, Every, Async, End };
+
+// How the test files are laid out before the write phase, -layout
+enum class Layout { Fresh, Overwrite, Fallocate, Sparse, Append };
+
+// Pages backing the I/O buffers, -hugebuf
+enum class Hugepages { Off, Transparent, Explicit };
+
+// Contents of the written blocks, -data
+enum class DataBase { Random, Zero, Fill };
+
+struct DataPattern {
+    DataBase base = DataBase::Random;
+    double compress = 1;     // target compression ratio of random data
+    int unique = 100;        // % of the written blocks that are not duplicates
+};
+
+// Units of a target rate, -rate
+enum class RateUnit { Iops, MBps, Peak };
+
+// One load level of the open-loop phases: IOPS, MiB/s or % of the
+// closed-loop rate of the step
+struct RateTarget {
+    double value = 0;
+    RateUnit unit = RateUnit::Iops;
+};
+
+// Commit policies of the write engines, -sync
+enum class SyncMode { None, End, Fsync, Fdatasync, FileRange, DSync, Sync };
+
+struct SyncPolicy {
+    SyncMode mode = SyncMode::End;
+    size_t every = 0;        // bytes between commits, the write-behind window
+};
+
+// Mapping options of the mmap engine
+struct MmapPolicy {
+    bool populate = false;   // MAP_POPULATE
+    bool sequential = false; // madvise(MADV_SEQUENTIAL)
+    bool willneed = false;   // madvise(MADV_WILLNEED)
+    bool hugepage = false;   // madvise(MADV_HUGEPAGE)
+    bool prefault = false;   // fault every page in before the I/O loop
+    MsyncMode msync = MsyncMode::Block;
+    size_t msyncEvery = 0;   // bytes between msync calls for MsyncMode::Every
+};
 
 struct Config {
     size_t minSize = 1024 * 1024;      // 1M
     size_t maxSize = 10 * 1024 * 1024; // 10M
     size_t strideSize = 1024 * 1024;   // 1M
     size_t bufferSize = 1024 * 1024;   // 1M
+    size_t bufferMax = 0;              // -buf=lo..hi sweep up to, 0 - no sweep
     int iterations = 1;
     bool useRamDisk = false;
+    bool hugeRamDisk = false;          // hugetlbfs instead of tmpfs (Linux)
     bool plotGraph = false;
+    bool directIO = true;              // bypass the page cache
+    unsigned queueDepth = 32;          // io_uring requests in flight
+    bool uringFixed = true;            // registered buffers and files
+    bool uringSqpoll = false;          // kernel submission polling thread
+    int jobs = 1;                      // worker threads
+    bool sharedFile = false;           // jobs split one file between them
+    Pattern pattern = Pattern::Sequential;
+    size_t blockSize = 0;              // I/O size, 0 - the buffer size
+    uint64_t seed = 1;                 // offset generator seed
+    double zipfTheta = 0.99;           // Zipf skew, 0 < theta < 1
+    int hotAccess = 90;                // % of accesses going to
+    int hotData = 10;                  // % of the blocks
+    bool verify = false;               // stamp and check every block
+    MmapPolicy mmap;                   // mmap engine options
+    vector<MmapPolicy> mmapSweep;      // combinations to run, -mmap x -msync
+    SyncPolicy sync;                   // commits of the rw, prw and prwv engines
+    vector<SyncPolicy> syncSweep;      // policies to run, -sync
+    bool copy = false;                 // benchmark the copy methods
+    unsigned iovCount = 4;             // prwv: segments per call
+    vector<size_t> iovSizes;           // prwv: explicit segment sizes
+    int rwFlags = 0;                   // prwv: RWF_* flags of every call
+    vector<pair<int, int>> mixes;      // read:write ratios of the mixed phase
+    string jsonPath;                   // structured results
+    string csvPath;
+    string comparePath;                // baseline JSON to compare with
+    double tolerance = 5;              // % change allowed by -compare
+    int warmup = 0;                    // discarded runs before the trials
+    int trials = 1;                    // runs of every size step
+    double ciTarget = 0;               // repeat until the 95% CI is within %
+    double budget = 0;                 // seconds of trials per size step
+    int sampleMs = 0;                  // throughput sampling interval, 0 - off
+    Layout layout = Layout::Fresh;
+    size_t metaFiles = 0;              // metadata workload, 0 - off
+    size_t metaSize = 4096;            // bytes written to every file
+    int metaFanout = 16;               // directories the files are spread over
+    bool metaDirsync = false;          // fsync the directory after every change
+    vector<int> cpus;                  // CPUs the jobs are pinned to in turn
+    vector<int> numaSweep;             // nodes the buffers are placed on, -numa
+    int numaNode = -1;                 // buffer node of a variant, -1 - any
+    Hugepages hugepages = Hugepages::Off;
+    DataPattern data;                  // contents of the written blocks
+    string recordPath;                 // trace of the write and read phases
+    string replayPath;                 // trace replayed instead of the steps
+    bool replayOriginal = false;       // at the trace timing, not back to back
+    string convertText;                // text trace converted to convertTrace
+    string convertTrace;
+    vector<RateTarget> rates;          // open-loop load levels, -rate
+    double paceIops = 0;               // of the rated phase being run, 0 - off
     Func function = Func::ReadWrite;
 };
 
@@ -172,35 +367,354 @@ void printHelp(const char *programName) {
          << "  -max=<size[KMG]>, --max=<size[KMG]>  Maximum file size (default: 10M)\n"
          << "  -s=<size[KMG]>, --s=<size[KMG]>      Stride size (default: 1M)\n"
          << "  -buf=<size[KMG]>, --buf=<size[KMG]>  Memory buffer size (default: 1M)\n"
-         << "  -f=<[rw|prw|mm|fs]>, --f=<[rw|prw|mm|fs]>    Functions for file operation:\n"
+         << "  -buf=<lo>..<hi>, --buf=<lo>..<hi>    Sweep the buffer size from lo to hi in\n"
+         << "                                       powers of two at every file size\n"
+         << "  -f=<[rw|prw|prwv|mm|fs|uring]>, --f=<[rw|prw|prwv|mm|fs|uring]>    Functions for file operation:\n"
          << "      rw - read/write\n"
          << "      prw - pread/pwrite\n"
+         << "      prwv - preadv2/pwritev2 (Linux)\n"
          << "      mm - mmap\n"
          << "      fs - fstream\n"
+         << "      uring - io_uring (Linux)\n"
+         << "  -qd=<N>, --qd=<N>                    io_uring queue depth (default: 32)\n"
+         << "  --no-fixed                           io_uring: do not register buffers and files\n"
+         << "  --sqpoll                             io_uring: use a kernel submission thread\n"
+         << "  -iov=<N|size,...>, --iov=<...>       prwv: number of iovecs per call, or their\n"
+         << "                                       sizes (default: 4)\n"
+         << "  -rwf=<flags>, --rwf=<flags>          prwv: comma separated nowait, hipri, dsync,\n"
+         << "                                       sync (default: none)\n"
          << "  -n=<N>, --n=<N>                      Number of iterations (default: 1)\n"
-         << "  -r, --r                              Use RAM disk (default: not used)\n"
-         << "  -p, --plot                           Enable plotting graph (default: off)\n"
+         << "  -pattern=<seq|rand|zipf|hot>         Access pattern of the prw, prwv, mm and uring\n"
+         << "                                       engines (default: seq)\n"
+         << "  -bs=<size[KMG]>, --bs=<size[KMG]>    Block size of the prw, prwv, mm and uring engines\n"
+         << "                                       (default: the buffer size)\n"
+         << "  -seed=<N>, --seed=<N>                Offset generator seed (default: 1)\n"
+         << "  -theta=<T>, --theta=<T>              Zipf skew, 0 < T < 1 (default: 0.99)\n"
+         << "  -hot=<A:D>, --hot=<A:D>              Hotspot: A% of accesses go to D% of the\n"
+         << "                                       blocks (default: 90:10)\n"
+         << "  -mmap=<opts[/opts...]>               mm: mapping options, a comma separated list\n"
+         << "                                       of populate, seq, willneed, huge, prefault\n"
+         << "                                       or none; variants separated by / are swept\n"
+         << "  -msync=<mode[/mode...]>              mm: msync after every block (block), every\n"
+         << "                                       <size[KMG]>, MS_ASYNC per block (async) or\n"
+         << "                                       once at the end (end); default: block\n"
+         << "  -meta=<N>, --meta=<N>                Metadata workload: create, write, fsync, stat,\n"
+         << "                                       rename and unlink N small files\n"
+         << "  -metasize=<size[KMG]>                Size of the metadata files (default: 4K)\n"
+         << "  -fanout=<N>, --fanout=<N>            Directories of the metadata files (default: 16)\n"
+         << "  -dirsync, --dirsync                  fsync the directory after every create,\n"
+         << "                                       rename and unlink\n"
+         << "  -rate=<list>, --rate=<list>          Open-loop phases at every load level:\n"
+         << "                                       IOPS, <N>MB MiB/s or <N>% of the closed\n"
+         << "                                       loop, curve - 10% to 100% (rw, prw, prwv)\n"
+         << "  -record=<file>, --record=<file>      Write a trace of the write and read phases of\n"
+         << "                                       every trial, with the commits (rw, prw, prwv)\n"
+         << "  -replay=<file>, --replay=<file>      Replay a trace instead of the size steps\n"
+         << "                                       (prw, prwv)\n"
+         << "  -timing=<fast|original>              Replay back to back or at the trace timing\n"
+         << "                                       (default: fast)\n"
+         << "  -convert=<text>,<trace>              Convert a text trace and exit\n"
+         << "  -layout=<fresh|overwrite|fallocate|sparse|append>\n"
+         << "                                       File layout before the write phase (default: fresh)\n"
+         << "  -mix=<R:W[/R:W...]>, --mix=<...>     Mixed phase: every job reads and overwrites\n"
+         << "                                       its region, each operation a write with\n"
+         << "                                       the share of the ratio (rw, prw, prwv, uring)\n"
+         << "  -warmup=<N>, --warmup=<N>            Discarded runs before every size step (default: 0)\n"
+         << "  -trials=<N>, --trials=<N>            Runs of every size step (default: 1)\n"
+         << "  -ci=<P>, --ci=<P>                    Repeat the runs until the 95% confidence\n"
+         << "                                       interval of the speeds is within P%\n"
+         << "  -budget=<S>, --budget=<S>            Repeat the runs for up to S seconds per step\n"
+         << "  -sample=<ms>, --sample=<ms>          Sample the throughput every ms milliseconds\n"
+         << "                                       within every phase (default: off)\n"
+         << "  -json=<file>, --json=<file>          Write the configuration, system and results as JSON\n"
+         << "  -csv=<file>, --csv=<file>            Write the results as CSV, one row per size step\n"
+         << "  -compare=<file>, --compare=<file>    Compare with a baseline JSON file, exit with 1\n"
+         << "                                       on throughput or p99 latency regressions;\n"
+         << "                                       the function, buffer, block size, jobs,\n"
+         << "                                       pattern and sync policy must match\n"
+         << "  -tolerance=<P>, --tolerance=<P>      Change in % -compare accepts (default: 5)\n"
+         << "  -copy, --copy                        Copy the written files with read/write,\n"
+         << "                                       sendfile, splice, copy_file_range and reflink\n"
+         << "  -sync=<policy[/policy...]>           rw, prw, prwv: none, end, fsync:<size>,\n"
+         << "                                       fdatasync:<size>, sfr:<size>, dsync, sync;\n"
+         << "                                       policies separated by / are swept (default: end)\n"
+         << "  -verify, --verify                    Stamp written blocks and check them on read\n"
+         << "  -j=<N>, --j=<N>                      Number of parallel jobs (default: 1)\n"
+         << "  -cpus=<list>, --cpus=<list>          Pin job i to the i-th CPU of a list such\n"
+         << "                                       as 0-3,8 (Linux)\n"
+         << "  -numa=<node[/node...]>               Place the I/O buffers on a NUMA node;\n"
+         << "                                       nodes separated by / are swept (Linux)\n"
+         << "  -hugebuf=<off|thp|explicit>          Back the I/O buffers with transparent or\n"
+         << "                                       hugetlb huge pages (Linux, default: off)\n"
+         << "  -data=<random|zero|fill>[,compress:<ratio>][,dedup:<unique %>]\n"
+         << "                                       Contents of the written blocks (default:\n"
+         << "                                       random, incompressible and unique)\n"
+         << "  --shared                             Jobs work on disjoint regions of one file\n"
+         << "                                       instead of a file each\n"
+         << "  -r, --r                              Use RAM disk (default: not used): hdiutil\n"
+         << "                                       on macOS, tmpfs in /dev/shm elsewhere\n"
+         << "  -r=huge, --r=huge                    Use a hugetlbfs mount as RAM disk (Linux,\n"
+         << "                                       mm function only)\n"
+         << "  -p, --plot                           Write SVG graphs (default: off)\n"
+         << "  -c, --cached                         Go through the page cache (default: bypass\n"
+         << "                                       with O_DIRECT on Linux, F_NOCACHE on macOS)\n"
          << "  -h, --help                           Show this help message and exit\n";
 }
 
+// "4K", "16M"
+string size_label(size_t bytes) {
+    const pair<size_t, const char *> units[] = {{1 << 30, "G"}, {1 << 20, "M"},
+        {1 << 10, "K"}};
+    for (const auto &[unit, suffix] : units) {
+        if (bytes >= unit && bytes % unit == 0) {
+            return to_string(bytes / unit) + suffix;
+        }
+    }
+    return to_string(bytes);
+}
+
+// ---- SVG plots ----
+// Graphs are written as plain SVG files, so the benchmark process runs no
+// plotting runtime next to the I/O it measures
+
+constexpr int PLOT_WIDTH = 800;
+constexpr int PLOT_HEIGHT = 600;
+constexpr int PLOT_LEFT = 80;
+constexpr int PLOT_TOP = 50;
+constexpr int PLOT_BOTTOM = 60;
+
+struct PlotSeries {
+    string name;
+    string color;
+    vector<double> x;
+    vector<double> y;
+};
+
+string svg_escape(const string &text) {
+    string escaped;
+    for (char c : text) {
+        switch (c) {
+            case '&': escaped += "&amp;"; break;
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '"': escaped += "&quot;"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+string tick_label(double value) {
+    ostringstream oss;
+    oss << setprecision(4) << value;
+    return oss.str();
+}
+
+// Round an axis maximum up to 1, 2 or 5 times a power of ten
+double nice_ceiling(double value) {
+    if (value <= 0) {
+        return 1;
+    }
+    double power = pow(10, floor(log10(value)));
+    for (double step : {1.0, 2.0, 5.0}) {
+        if (step * power >= value) {
+            return step * power;
+        }
+    }
+    return 10 * power;
+}
+
+// SVG document with the title and axis labels of a plot area `right` pixels
+// away from the right edge
+ofstream open_svg(const string &filename, const string &title,
+    const string &x_label, const string &y_label, int right) {
+    ofstream out(filename);
+    if (!out) {
+        throw invalid_argument("cannot write " + filename);
+    }
+    int plot_center = PLOT_LEFT + (PLOT_WIDTH - PLOT_LEFT - right) / 2;
+    int plot_middle = PLOT_TOP + (PLOT_HEIGHT - PLOT_TOP - PLOT_BOTTOM) / 2;
+    out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << PLOT_WIDTH <<
+        "\" height=\"" << PLOT_HEIGHT << "\" font-family=\"sans-serif\" "
+        "font-size=\"12\">\n"
+        "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n"
+        "<text x=\"" << plot_center << "\" y=\"30\" text-anchor=\"middle\" "
+        "font-size=\"16\">" << svg_escape(title) << "</text>\n"
+        "<text x=\"" << plot_center << "\" y=\"" << PLOT_HEIGHT - 15 <<
+        "\" text-anchor=\"middle\">" << svg_escape(x_label) << "</text>\n"
+        "<text x=\"20\" y=\"" << plot_middle << "\" text-anchor=\"middle\" "
+        "transform=\"rotate(-90 20 " << plot_middle << ")\">" <<
+        svg_escape(y_label) << "</text>\n";
+    return out;
+}
+
+// Line graph with a grid and a legend, the Y axis starts at 0
+void plotLines(const vector<PlotSeries> &series, const string &title,
+    const string &x_label, const string &y_label, const string &filename) {
+    double x_min = numeric_limits<double>::max();
+    double x_max = numeric_limits<double>::lowest();
+    double y_max = 0;
+    for (const auto &line : series) {
+        for (size_t i = 0; i < line.x.size(); ++i) {
+            x_min = min(x_min, line.x[i]);
+            x_max = max(x_max, line.x[i]);
+            y_max = max(y_max, line.y[i]);
+        }
+    }
+    if (x_min > x_max) {
+        return;
+    }
+    if (x_max == x_min) {
+        x_max = x_min + 1;
+    }
+    // some space on the top
+    y_max = nice_ceiling(y_max * 1.1);
+
+    const int right = 30;
+    double width = PLOT_WIDTH - PLOT_LEFT - right;
+    double height = PLOT_HEIGHT - PLOT_TOP - PLOT_BOTTOM;
+    auto px = [&](double x) { return PLOT_LEFT + (x - x_min) / (x_max - x_min) * width; };
+    auto py = [&](double y) { return PLOT_TOP + height - y / y_max * height; };
+
+    ofstream out = open_svg(filename, title, x_label, y_label, right);
+    const int ticks = 5;
+    for (int i = 0; i <= ticks; ++i) {
+        double x = px(x_min + (x_max - x_min) * i / ticks);
+        double y = py(y_max * i / ticks);
+        out << "<line x1=\"" << x << "\" y1=\"" << PLOT_TOP << "\" x2=\"" << x <<
+            "\" y2=\"" << PLOT_TOP + height << "\" stroke=\"#ddd\"/>\n"
+            "<text x=\"" << x << "\" y=\"" << PLOT_TOP + height + 18 <<
+            "\" text-anchor=\"middle\">" <<
+            tick_label(x_min + (x_max - x_min) * i / ticks) << "</text>\n"
+            "<line x1=\"" << PLOT_LEFT << "\" y1=\"" << y << "\" x2=\"" <<
+            PLOT_LEFT + width << "\" y2=\"" << y << "\" stroke=\"#ddd\"/>\n"
+            "<text x=\"" << PLOT_LEFT - 6 << "\" y=\"" << y + 4 <<
+            "\" text-anchor=\"end\">" << tick_label(y_max * i / ticks) << "</text>\n";
+    }
+    out << "<rect x=\"" << PLOT_LEFT << "\" y=\"" << PLOT_TOP << "\" width=\"" <<
+        width << "\" height=\"" << height << "\" fill=\"none\" stroke=\"black\"/>\n";
+    for (size_t s = 0; s < series.size(); ++s) {
+        const auto &line = series[s];
+        out << "<polyline fill=\"none\" stroke=\"" << line.color <<
+            "\" stroke-width=\"1.5\" points=\"";
+        for (size_t i = 0; i < line.x.size(); ++i) {
+            out << px(line.x[i]) << ',' << py(line.y[i]) << ' ';
+        }
+        out << "\"/>\n";
+        double y = PLOT_TOP + 20 + 18 * s;
+        out << "<line x1=\"" << PLOT_LEFT + width - 90 << "\" y1=\"" << y - 4 <<
+            "\" x2=\"" << PLOT_LEFT + width - 65 << "\" y2=\"" << y - 4 <<
+            "\" stroke=\"" << line.color << "\" stroke-width=\"1.5\"/>\n"
+            "<text x=\"" << PLOT_LEFT + width - 58 << "\" y=\"" << y << "\">" <<
+            svg_escape(line.name) << "</text>\n";
+    }
+    out << "</svg>\n";
+}
+
+// Viridis-like colour of a value from 0 to 1
+string heat_color(double value) {
+    static const int stops[][3] = {{68, 1, 84}, {59, 82, 139}, {33, 145, 140},
+        {94, 201, 98}, {253, 231, 37}};
+    double position = clamp(value, 0.0, 1.0) * 4;
+    int i = min(static_cast<int>(position), 3);
+    double fraction = position - i;
+    ostringstream oss;
+    oss << "rgb(";
+    for (int c = 0; c < 3; ++c) {
+        oss << static_cast<int>(stops[i][c] + (stops[i + 1][c] - stops[i][c]) *
+            fraction) << (c < 2 ? "," : ")");
+    }
+    return oss.str();
+}
+
 void plotGraph(vector<double> &sizes_mb, vector<double> &write_speeds,
     vector<double> &read_speeds, string &filename) {
-    // Draw a plot
-    plt::figure_size(800, 600);
-    plt::named_plot("Write", sizes_mb, write_speeds, "r-");
-    plt::named_plot("Read", sizes_mb, read_speeds, "b-");
-    plt::xlabel("File size (MB)");
-    plt::ylabel("Speed (MB/s)");
-    plt::title("Disk Write/Read Speed vs File Size");
-    plt::legend();
-    plt::grid(true);
-    // find maximum
-    double max_write = *std::max_element(write_speeds.begin(), write_speeds.end());
-    double max_read = *std::max_element(read_speeds.begin(), read_speeds.end());
-    double y_max = std::max(max_write, max_read) * 1.1; // add some space on the top
-    // set limits for Y axis from 0 to y_max
-    plt::ylim(0.0, y_max);
-    plt::save("speed_graph.png");
+    plotLines({{"Write", "red", sizes_mb, write_speeds},
+        {"Read", "blue", sizes_mb, read_speeds}},
+        "Disk Write/Read Speed vs File Size", "File size (MB)", "Speed (MB/s)",
+        filename);
+}
+
+// File size x block size speed grid of a buffer size sweep, the smallest
+// file size at the bottom
+void plotHeatmap(const vector<vector<double>> &grid, const vector<size_t> &sizes,
+    const vector<size_t> &blocks, const string &title, const string &filename) {
+    double top = 0;
+    for (const auto &row : grid) {
+        top = max(top, *max_element(row.begin(), row.end()));
+    }
+    if (top <= 0) {
+        top = 1;
+    }
+    const int right = 110;
+    double width = PLOT_WIDTH - PLOT_LEFT - right;
+    double height = PLOT_HEIGHT - PLOT_TOP - PLOT_BOTTOM;
+    double cell_width = width / blocks.size();
+    double cell_height = height / sizes.size();
+
+    ofstream out = open_svg(filename, title, "Block size", "File size", right);
+    for (size_t row = 0; row < sizes.size(); ++row) {
+        double y = PLOT_TOP + height - (row + 1) * cell_height;
+        out << "<text x=\"" << PLOT_LEFT - 6 << "\" y=\"" << y + cell_height / 2 + 4 <<
+            "\" text-anchor=\"end\">" << size_label(sizes[row]) << "</text>\n";
+        for (size_t column = 0; column < blocks.size(); ++column) {
+            double value = grid[row][column] / top;
+            double x = PLOT_LEFT + column * cell_width;
+            out << "<rect x=\"" << x << "\" y=\"" << y << "\" width=\"" <<
+                cell_width << "\" height=\"" << cell_height << "\" fill=\"" <<
+                heat_color(value) << "\"/>\n"
+                "<text x=\"" << x + cell_width / 2 << "\" y=\"" <<
+                y + cell_height / 2 + 4 << "\" text-anchor=\"middle\" fill=\"" <<
+                (value < 0.6 ? "white" : "black") << "\">" <<
+                static_cast<long>(grid[row][column]) << "</text>\n";
+        }
+    }
+    for (size_t column = 0; column < blocks.size(); ++column) {
+        out << "<text x=\"" << PLOT_LEFT + (column + 0.5) * cell_width <<
+            "\" y=\"" << PLOT_TOP + height + 18 << "\" text-anchor=\"middle\">" <<
+            size_label(blocks[column]) << "</text>\n";
+    }
+    // colour bar
+    const int steps = 50;
+    double bar_x = PLOT_WIDTH - right + 30;
+    for (int i = 0; i < steps; ++i) {
+        out << "<rect x=\"" << bar_x << "\" y=\"" <<
+            PLOT_TOP + height - (i + 1) * height / steps << "\" width=\"20\" "
+            "height=\"" << height / steps + 0.5 << "\" fill=\"" <<
+            heat_color((i + 0.5) / steps) << "\"/>\n";
+    }
+    for (int i = 0; i <= 5; ++i) {
+        out << "<text x=\"" << bar_x + 26 << "\" y=\"" <<
+            PLOT_TOP + height - i * height / 5 + 4 << "\">" <<
+            tick_label(top * i / 5) << "</text>\n";
+    }
+    out << "</svg>\n";
+}
+
+// Throughput within the write and read phases of a size step, -sample: the
+// (seconds, MB/s) points at the times the samples were taken
+void plotTimeline(const vector<pair<double, double>> &write_speeds,
+    const vector<pair<double, double>> &read_speeds, const string &filename) {
+    auto series = [](const char *name, const char *color,
+        const vector<pair<double, double>> &points) {
+        PlotSeries line{name, color, {}, {}};
+        for (const auto &[seconds, speed] : points) {
+            line.x.push_back(seconds);
+            line.y.push_back(speed);
+        }
+        return line;
+    };
+    plotLines({series("Write", "red", write_speeds),
+        series("Read", "blue", read_speeds)},
+        "Disk Write/Read Speed over Time", "Time in phase (s)", "Speed (MB/s)",
+        filename);
+}
+
+// Latency versus throughput of the -rate levels, one point per level
+void plotRateCurve(const vector<PlotSeries> &curves, const string &filename) {
+    plotLines(curves,
+        "Latency vs Throughput", "Achieved speed (MB/s)", "Latency (us)",
+        filename);
 }
 
 Func parseFunc(const string &str) {
@@ -210,13 +724,344 @@ Func parseFunc(const string &str) {
         return Func::ReadWrite;
     if (str == "prw")
         return Func::PReadWrite;        
+    if (str == "prwv") {
+#ifndef HAVE_PREADV2
+        throw invalid_argument("preadv2/pwritev2 are not supported on this "
+            "platform");
+#endif
+        return Func::PReadWriteV;
+    }
     if (str == "mm")
         return Func::MMap;
     if (str == "fs")
         return Func::FStream;
+    if (str == "uring") {
+#ifndef HAVE_IO_URING
+        throw invalid_argument("io_uring is not supported on this platform");
+#endif
+        return Func::Uring;
+    }
     throw invalid_argument("Wrong function string");
 }
 
+Pattern parsePattern(const string &str) {
+    if (str == "seq")
+        return Pattern::Sequential;
+    if (str == "rand")
+        return Pattern::Random;
+    if (str == "zipf")
+        return Pattern::Zipf;
+    if (str == "hot")
+        return Pattern::Hotspot;
+    throw invalid_argument("Wrong access pattern string");
+}
+
+// Split "a/b/c" into its parts
+vector<string> splitList(const string &str, char separator) {
+    vector<string> parts;
+    istringstream iss(str);
+    string part;
+    while (getline(iss, part, separator)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+size_t parseSize(const string &str);
+
+// "populate,seq" - mapping options of one mmap variant
+MmapPolicy parseMmapPolicy(const string &str) {
+    MmapPolicy policy;
+    for (const auto &option : splitList(str, ',')) {
+        if (option == "populate")
+            policy.populate = true;
+        else if (option == "seq")
+            policy.sequential = true;
+        else if (option == "willneed")
+            policy.willneed = true;
+        else if (option == "huge")
+            policy.hugepage = true;
+        else if (option == "prefault")
+            policy.prefault = true;
+        else if (option != "none")
+            throw invalid_argument("Wrong mmap option string");
+    }
+    return policy;
+}
+
+string_view hugepagesName(Hugepages hugepages) {
+    string_view names[] = {"off", "thp", "explicit"};
+    return names[int(hugepages)];
+}
+
+Hugepages parseHugepages(const string &str) {
+    for (Hugepages hugepages : {Hugepages::Off, Hugepages::Transparent,
+        Hugepages::Explicit}) {
+        if (str == hugepagesName(hugepages)) {
+            return hugepages;
+        }
+    }
+    throw invalid_argument("Wrong hugebuf string");
+}
+
+// "random", "zero", "fill" or random data with "compress:<ratio>" and
+// "dedup:<unique %>", e.g. "compress:2,dedup:25"
+DataPattern parseData(const string &str) {
+    DataPattern data;
+    for (const auto &item : splitList(str, ',')) {
+        size_t colon = item.find(':');
+        string name = item.substr(0, colon);
+        if (colon == string::npos && (name == "random" || name == "zero" ||
+            name == "fill")) {
+            data.base = name == "random" ? DataBase::Random : name == "zero" ?
+                DataBase::Zero : DataBase::Fill;
+        }
+        else if (colon != string::npos && name == "compress") {
+            data.compress = stod(item.substr(colon + 1));
+        }
+        else if (colon != string::npos && name == "dedup") {
+            data.unique = stoi(item.substr(colon + 1));
+        }
+        else {
+            throw invalid_argument("Wrong data string");
+        }
+    }
+    if (data.compress < 1 || data.unique < 1 || data.unique > 100) {
+        throw invalid_argument("the compression ratio must be at least 1 and "
+            "the unique share between 1 and 100%");
+    }
+    if (data.base != DataBase::Random && (data.compress > 1 ||
+        data.unique < 100)) {
+        throw invalid_argument("compress and dedup apply to random data only");
+    }
+    return data;
+}
+
+string data_label(const DataPattern &data) {
+    string_view names[] = {"random", "zero", "fill"};
+    ostringstream oss;
+    oss << names[int(data.base)];
+    if (data.compress > 1) {
+        oss << ",compress:" << data.compress;
+    }
+    if (data.unique < 100) {
+        oss << ",dedup:" << data.unique;
+    }
+    return oss.str();
+}
+
+// "5000" - IOPS, "200MB" - MiB/s, "60%" - of the closed-loop rate
+RateTarget parseRate(const string &str) {
+    RateTarget target;
+    size_t end = 0;
+    target.value = stod(str, &end);
+    string unit = str.substr(end);
+    if (unit == "MB") {
+        target.unit = RateUnit::MBps;
+    }
+    else if (unit == "%") {
+        target.unit = RateUnit::Peak;
+    }
+    else if (!unit.empty()) {
+        throw invalid_argument("Wrong rate string");
+    }
+    if (target.value <= 0) {
+        throw invalid_argument("rates must be positive");
+    }
+    return target;
+}
+
+string rate_label(const RateTarget &target) {
+    ostringstream oss;
+    oss << target.value;
+    string_view units[] = {" IOPS", " MB/s", "%"};
+    return oss.str() + string(units[int(target.unit)]);
+}
+
+// "0-3,8" - CPUs 0, 1, 2, 3 and 8
+vector<int> parseCpuList(const string &str) {
+    vector<int> cpus;
+    for (const auto &range : splitList(str, ',')) {
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+        if (first < 0 || last < first || last >= CPU_SETSIZE) {
+            throw invalid_argument("Wrong CPU list");
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        throw invalid_argument("Wrong CPU list");
+    }
+    return cpus;
+}
+
+Layout parseLayout(const string &str) {
+    if (str == "fresh")
+        return Layout::Fresh;
+    if (str == "overwrite")
+        return Layout::Overwrite;
+    if (str == "fallocate")
+        return Layout::Fallocate;
+    if (str == "sparse")
+        return Layout::Sparse;
+    if (str == "append")
+        return Layout::Append;
+    throw invalid_argument("Wrong layout string");
+}
+
+string_view layoutName(Layout layout) {
+    string_view names[] = {"fresh", "overwrite", "fallocate", "sparse",
+        "append"};
+    return names[int(layout)];
+}
+
+// "8" - number of iovecs, "4K,4K,8K" - their sizes
+void parseIovecs(const string &str, Config &config) {
+    if (str.find_first_not_of("0123456789") == string::npos) {
+        config.iovCount = stoul(str);
+        config.iovSizes.clear();
+        if (config.iovCount == 0 || config.iovCount > IOV_MAX)
+            throw invalid_argument("Wrong iovec count");
+        return;
+    }
+    config.iovSizes.clear();
+    for (const auto &size : splitList(str, ',')) {
+        config.iovSizes.push_back(parseSize(size));
+        if (config.iovSizes.back() == 0)
+            throw invalid_argument("Wrong iovec size");
+    }
+    if (config.iovSizes.empty() || config.iovSizes.size() > IOV_MAX)
+        throw invalid_argument("Wrong iovec string");
+    config.iovCount = config.iovSizes.size();
+}
+
+// "nowait,hipri" - RWF_* flags of the prwv engine
+int parseRwFlags(const string &str) {
+    int flags = 0;
+    for (const auto &flag : splitList(str, ',')) {
+#ifdef HAVE_PREADV2
+        if (flag == "nowait")
+            flags |= RWF_NOWAIT;
+        else if (flag == "hipri")
+            flags |= RWF_HIPRI;
+        else if (flag == "dsync")
+            flags |= RWF_DSYNC;
+        else if (flag == "sync")
+            flags |= RWF_SYNC;
+        else if (flag != "none")
+#else
+        if (flag != "none")
+#endif
+            throw invalid_argument("Wrong RWF flag string");
+    }
+    return flags;
+}
+
+// "block", "async", "end" or a size - msync policy of one mmap variant
+void parseMsync(const string &str, MmapPolicy &policy) {
+    if (str == "block")
+        policy.msync = MsyncMode::Block;
+    else if (str == "async")
+        policy.msync = MsyncMode::Async;
+    else if (str == "end")
+        policy.msync = MsyncMode::End;
+    else {
+        policy.msync = MsyncMode::Every;
+        policy.msyncEvery = parseSize(str);
+        if (policy.msyncEvery == 0)
+            throw invalid_argument("Wrong msync string");
+    }
+}
+
+string mmapPolicyName(const MmapPolicy &policy) {
+    string name;
+    auto add = [&name](bool on, const char *option) {
+        if (on) {
+            name += name.empty() ? option : string(",") + option;
+        }
+    };
+    add(policy.populate, "populate");
+    add(policy.sequential, "seq");
+    add(policy.willneed, "willneed");
+    add(policy.hugepage, "huge");
+    add(policy.prefault, "prefault");
+    if (name.empty()) {
+        name = "none";
+    }
+    name += ", msync ";
+    switch (policy.msync) {
+    case MsyncMode::Block: return name + "block";
+    case MsyncMode::Async: return name + "async";
+    case MsyncMode::End: return name + "end";
+    case MsyncMode::Every: return name + "every " + to_string(policy.msyncEvery);
+    }
+    return name;
+}
+
+// "fdatasync:16K", "dsync" - commit policy of the write engines
+SyncPolicy parseSync(const string &str) {
+    SyncPolicy policy;
+    size_t colon = str.find(':');
+    string mode = str.substr(0, colon);
+    if (mode == "none")
+        policy.mode = SyncMode::None;
+    else if (mode == "end")
+        policy.mode = SyncMode::End;
+    else if (mode == "fsync")
+        policy.mode = SyncMode::Fsync;
+    else if (mode == "fdatasync")
+        policy.mode = SyncMode::Fdatasync;
+    else if (mode == "sfr") {
+#ifndef __linux__
+        throw invalid_argument("sync_file_range is supported on Linux only");
+#endif
+        policy.mode = SyncMode::FileRange;
+    }
+    else if (mode == "dsync")
+        policy.mode = SyncMode::DSync;
+    else if (mode == "sync")
+        policy.mode = SyncMode::Sync;
+    else
+        throw invalid_argument("Wrong sync string");
+    bool periodic = policy.mode == SyncMode::Fsync ||
+        policy.mode == SyncMode::Fdatasync || policy.mode == SyncMode::FileRange;
+    if (periodic != (colon != string::npos))
+        throw invalid_argument("Wrong sync string");
+    if (periodic) {
+        policy.every = parseSize(str.substr(colon + 1));
+        if (policy.every == 0)
+            throw invalid_argument("Wrong sync string");
+    }
+    return policy;
+}
+
+string syncPolicyName(const SyncPolicy &policy) {
+    switch (policy.mode) {
+    case SyncMode::None: return "none";
+    case SyncMode::End: return "fsync at end";
+    case SyncMode::Fsync: return "fsync every " + to_string(policy.every);
+    case SyncMode::Fdatasync: return "fdatasync every " +
+        to_string(policy.every);
+    case SyncMode::FileRange: return "sync_file_range window " +
+        to_string(policy.every);
+    case SyncMode::DSync: return "O_DSYNC";
+    case SyncMode::Sync: return "O_SYNC";
+    }
+    return "";
+}
+
+// The swept sync policies, as the JSON config and -compare see them
+string sync_label(const Config &config) {
+    string label;
+    for (const auto &policy : config.syncSweep) {
+        label += (label.empty() ? "" : "/") + syncPolicyName(policy);
+    }
+    return label;
+}
+
 size_t parseSize(const string &str) {
     if (str.empty())
         throw invalid_argument("Empty size string");
@@ -278,6 +1123,9 @@ string formatSize(size_t bytes) {
 
 Config parseArgs(int argc, char *argv[]) {
     Config config;
+    vector<string> mmap_options{"none"};
+    vector<string> msync_options{"block"};
+    vector<string> sync_options{"end"};
 
     for (int i = 1; i < argc; ++i) {
         string arg = argv[i];
@@ -285,9 +1133,204 @@ Config parseArgs(int argc, char *argv[]) {
         if (arg == "-r" || arg == "--r") {
             config.useRamDisk = true;
         }
+        else if (arg == "-r=huge" || arg == "--r=huge") {
+            config.useRamDisk = true;
+            config.hugeRamDisk = true;
+        }
         else if (arg == "-p" || arg == "--plot") {
             config.plotGraph = true;
         }
+        else if (arg == "-c" || arg == "--cached") {
+            config.directIO = false;
+        }
+        else if (arg == "--no-fixed") {
+            config.uringFixed = false;
+        }
+        else if (arg == "--sqpoll") {
+            config.uringSqpoll = true;
+        }
+        else if (arg == "-copy" || arg == "--copy") {
+            config.copy = true;
+        }
+        else if (arg == "-verify" || arg == "--verify") {
+            config.verify = true;
+        }
+        else if (arg == "--shared") {
+            config.sharedFile = true;
+        }
+        else if (arg.find("-pattern=") == 0) {
+            config.pattern = parsePattern(arg.substr(9));
+        }
+        else if (arg.find("--pattern=") == 0) {
+            config.pattern = parsePattern(arg.substr(10));
+        }
+        else if (arg.find("-bs=") == 0) {
+            config.blockSize = parseSize(arg.substr(4));
+        }
+        else if (arg.find("--bs=") == 0) {
+            config.blockSize = parseSize(arg.substr(5));
+        }
+        else if (arg.find("-seed=") == 0) {
+            config.seed = stoull(arg.substr(6));
+        }
+        else if (arg.find("--seed=") == 0) {
+            config.seed = stoull(arg.substr(7));
+        }
+        else if (arg.find("-theta=") == 0) {
+            config.zipfTheta = stod(arg.substr(7));
+        }
+        else if (arg.find("--theta=") == 0) {
+            config.zipfTheta = stod(arg.substr(8));
+        }
+        else if (arg.find("-mmap=") == 0 || arg.find("--mmap=") == 0) {
+            mmap_options = splitList(arg.substr(arg.find('=') + 1), '/');
+        }
+        else if (arg.find("-sync=") == 0 || arg.find("--sync=") == 0) {
+            sync_options = splitList(arg.substr(arg.find('=') + 1), '/');
+        }
+        else if (arg.find("-msync=") == 0 || arg.find("--msync=") == 0) {
+            msync_options = splitList(arg.substr(arg.find('=') + 1), '/');
+        }
+        else if (arg.find("-rate=") == 0 || arg.find("--rate=") == 0) {
+            string rates = arg.substr(arg.find('=') + 1);
+            if (rates == "curve") {
+                for (int percent = 10; percent <= 100; percent += 10) {
+                    config.rates.push_back({double(percent), RateUnit::Peak});
+                }
+            }
+            else {
+                for (const auto &rate : splitList(rates, ',')) {
+                    config.rates.push_back(parseRate(rate));
+                }
+            }
+        }
+        else if (arg.find("-record=") == 0 || arg.find("--record=") == 0) {
+            config.recordPath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.find("-replay=") == 0 || arg.find("--replay=") == 0) {
+            config.replayPath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.find("-timing=") == 0 || arg.find("--timing=") == 0) {
+            string timing = arg.substr(arg.find('=') + 1);
+            if (timing != "fast" && timing != "original") {
+                throw invalid_argument("Wrong timing string");
+            }
+            config.replayOriginal = timing == "original";
+        }
+        else if (arg.find("-convert=") == 0 || arg.find("--convert=") == 0) {
+            auto paths = splitList(arg.substr(arg.find('=') + 1), ',');
+            if (paths.size() != 2) {
+                throw invalid_argument("-convert needs <text>,<trace>");
+            }
+            config.convertText = paths[0];
+            config.convertTrace = paths[1];
+        }
+        else if (arg.find("-meta=") == 0 || arg.find("--meta=") == 0) {
+            config.metaFiles = stoull(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-metasize=") == 0 || arg.find("--metasize=") == 0) {
+            config.metaSize = parseSize(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-fanout=") == 0 || arg.find("--fanout=") == 0) {
+            config.metaFanout = stoi(arg.substr(arg.find('=') + 1));
+            if (config.metaFanout < 1) {
+                throw invalid_argument("fan-out must be positive");
+            }
+        }
+        else if (arg == "-dirsync" || arg == "--dirsync") {
+            config.metaDirsync = true;
+        }
+        else if (arg.find("-layout=") == 0 || arg.find("--layout=") == 0) {
+            config.layout = parseLayout(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-mix=") == 0 || arg.find("--mix=") == 0) {
+            for (const auto &mix : splitList(arg.substr(arg.find('=') + 1), '/')) {
+                size_t colon = mix.find(':');
+                if (colon == string::npos) {
+                    throw invalid_argument("Wrong mix string");
+                }
+                config.mixes.emplace_back(stoi(mix.substr(0, colon)),
+                    stoi(mix.substr(colon + 1)));
+            }
+        }
+        else if (arg.find("-warmup=") == 0 || arg.find("--warmup=") == 0) {
+            config.warmup = stoi(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-trials=") == 0 || arg.find("--trials=") == 0) {
+            config.trials = stoi(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-ci=") == 0 || arg.find("--ci=") == 0) {
+            config.ciTarget = stod(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-budget=") == 0 || arg.find("--budget=") == 0) {
+            config.budget = stod(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-sample=") == 0 || arg.find("--sample=") == 0) {
+            config.sampleMs = stoi(arg.substr(arg.find('=') + 1));
+            if (config.sampleMs < 0) {
+                throw invalid_argument("sampling interval cannot be negative");
+            }
+        }
+        else if (arg.find("-json=") == 0 || arg.find("--json=") == 0) {
+            config.jsonPath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.find("-csv=") == 0 || arg.find("--csv=") == 0) {
+            config.csvPath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.find("-compare=") == 0 || arg.find("--compare=") == 0) {
+            config.comparePath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.find("-tolerance=") == 0 || arg.find("--tolerance=") == 0) {
+            config.tolerance = stod(arg.substr(arg.find('=') + 1));
+            if (config.tolerance < 0) {
+                throw invalid_argument("tolerance cannot be negative");
+            }
+        }
+        else if (arg.find("-iov=") == 0 || arg.find("--iov=") == 0) {
+            parseIovecs(arg.substr(arg.find('=') + 1), config);
+        }
+        else if (arg.find("-rwf=") == 0 || arg.find("--rwf=") == 0) {
+            config.rwFlags = parseRwFlags(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-hot=") == 0 || arg.find("--hot=") == 0) {
+            string value = arg.substr(arg.find('=') + 1);
+            size_t colon = value.find(':');
+            if (colon == string::npos) {
+                throw invalid_argument("Wrong hotspot string");
+            }
+            config.hotAccess = stoi(value.substr(0, colon));
+            config.hotData = stoi(value.substr(colon + 1));
+        }
+        else if (arg.find("-j=") == 0) {
+            config.jobs = stoi(arg.substr(3));
+        }
+        else if (arg.find("--j=") == 0) {
+            config.jobs = stoi(arg.substr(4));
+        }
+        else if (arg.find("-cpus=") == 0 || arg.find("--cpus=") == 0) {
+            config.cpus = parseCpuList(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-numa=") == 0 || arg.find("--numa=") == 0) {
+            config.numaSweep.clear();
+            for (const auto &node : splitList(arg.substr(arg.find('=') + 1), '/')) {
+                config.numaSweep.push_back(stoi(node));
+                if (config.numaSweep.back() < 0 || config.numaSweep.back() >= 64) {
+                    throw invalid_argument("Wrong NUMA node");
+                }
+            }
+        }
+        else if (arg.find("-data=") == 0 || arg.find("--data=") == 0) {
+            config.data = parseData(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-hugebuf=") == 0 || arg.find("--hugebuf=") == 0) {
+            config.hugepages = parseHugepages(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.find("-qd=") == 0) {
+            config.queueDepth = stoul(arg.substr(4));
+        }
+        else if (arg.find("--qd=") == 0) {
+            config.queueDepth = stoul(arg.substr(5));
+        }
         else if (arg == "-h" || arg == "--help") {
             printHelp(argv[0]);
             exit(0);
@@ -310,11 +1353,17 @@ Config parseArgs(int argc, char *argv[]) {
         else if (arg.find("--s=") == 0) {
             config.strideSize = parseSize(arg.substr(4));
         }
-        else if (arg.find("-buf=") == 0) {
-            config.bufferSize = parseSize(arg.substr(5));
-        }
-        else if (arg.find("--buf=") == 0) {
-            config.bufferSize = parseSize(arg.substr(6));
+        else if (arg.find("-buf=") == 0 || arg.find("--buf=") == 0) {
+            string value = arg.substr(arg.find('=') + 1);
+            size_t range = value.find("..");
+            config.bufferSize = parseSize(value.substr(0, range));
+            config.bufferMax = 0;
+            if (range != string::npos) {
+                config.bufferMax = parseSize(value.substr(range + 2));
+                if (config.bufferMax <= config.bufferSize) {
+                    throw invalid_argument("Wrong buffer size range");
+                }
+            }
         }
         else if (arg.find("-n=") == 0) {
             config.iterations = stoi(arg.substr(3));
@@ -338,234 +1387,5069 @@ Config parseArgs(int argc, char *argv[]) {
     if (config.minSize > config.maxSize) {
         throw invalid_argument("minSize cannot be greater than maxSize");
     }
-    if (config.strideSize > (config.maxSize - config.minSize)) {
-        throw invalid_argument("strideSize cannot be greater than (maxSize -"
-            " minSize)");
+#ifdef __APPLE__
+    if (config.hugeRamDisk) {
+        throw invalid_argument("hugetlbfs RAM disk is supported on Linux only");
     }
-
-    return config;
-}
-
-void fs_write_file(const string &filename, const vector<unsigned char> &buffer,
-    const size_t size_bytes) {
-    ofstream file(filename, ios::binary);
-    size_t written = 0;
-    while (written < size_bytes) {
-        size_t to_write = min(buffer.size(), size_bytes - written);
-        file.write(reinterpret_cast<const char *>(buffer.data()), to_write);
-        written += to_write;
+    if (!config.cpus.empty() || config.hugepages != Hugepages::Off) {
+        throw invalid_argument("CPU pinning and huge page buffers are supported "
+            "on Linux only");
     }
-    file.close();
-}
-
-uint8_t fs_read_file(const string &filename, vector<unsigned char> &buffer,
-    const size_t size_bytes) {
-    ifstream file(filename, ios::binary);
-    uint8_t checksum = 0;
-    size_t read = 0;
-    while (read < size_bytes) {
-        size_t to_read = min(buffer.size(), size_bytes - read);
-        file.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+#endif
+#ifndef HAVE_MEMPOLICY
+    if (!config.numaSweep.empty()) {
+        throw invalid_argument("NUMA placement is supported on Linux only");
+    }
+#endif
+    // every mapping variant with every msync variant
+    for (const auto &mmap_option : mmap_options) {
+        for (const auto &msync_option : msync_options) {
+            MmapPolicy policy = parseMmapPolicy(mmap_option);
+            parseMsync(msync_option, policy);
+            config.mmapSweep.push_back(policy);
+        }
+    }
+    if (config.function != Func::MMap && (mmap_options.size() > 1 ||
+        msync_options.size() > 1 || mmap_options[0] != "none" ||
+        msync_options[0] != "block")) {
+        throw invalid_argument("mmap options are supported by the mm function "
+            "only");
+    }
+    config.mmap = config.mmapSweep.front();
+    for (const auto &sync_option : sync_options) {
+        config.syncSweep.push_back(parseSync(sync_option));
+    }
+    bool sync_engine = config.function == Func::ReadWrite ||
+        config.function == Func::PReadWrite ||
+        config.function == Func::PReadWriteV;
+    if (!sync_engine && (config.syncSweep.size() > 1 ||
+        config.syncSweep[0].mode != SyncMode::End)) {
+        throw invalid_argument("sync policies are supported by the rw, prw and "
+            "prwv functions only");
+    }
+    config.sync = config.syncSweep.front();
+    if (config.hugeRamDisk && config.function != Func::MMap) {
+        throw invalid_argument("hugetlbfs supports the mm function only");
+    }
+    if (config.jobs < 1) {
+        throw invalid_argument("number of jobs must be positive");
+    }
+    bool block_engine = config.function == Func::PReadWrite ||
+        config.function == Func::PReadWriteV ||
+        config.function == Func::MMap || config.function == Func::Uring;
+    if (!block_engine && (config.pattern != Pattern::Sequential ||
+        config.blockSize)) {
+        throw invalid_argument("access patterns and block sizes are supported "
+            "by the prw, prwv, mm and uring functions only");
+    }
+    if (config.verify && config.data.unique < 100) {
+        throw invalid_argument("the verification headers make every block "
+            "unique, -data=dedup cannot be verified");
+    }
+    if (!config.rates.empty() && (config.metaFiles ||
+        !config.replayPath.empty() || !(config.function == Func::ReadWrite ||
+        config.function == Func::PReadWrite ||
+        config.function == Func::PReadWriteV))) {
+        throw invalid_argument("-rate is supported by the rw, prw and prwv "
+            "functions only and not with -meta or -replay");
+    }
+    if (!config.recordPath.empty() && (config.metaFiles || !(config.function ==
+        Func::ReadWrite || config.function == Func::PReadWrite ||
+        config.function == Func::PReadWriteV))) {
+        throw invalid_argument("-record is supported by the rw, prw and prwv "
+            "functions only and not with -meta");
+    }
+    // every file of a step is a trace slot, numbered 0..UINT16_MAX
+    if (!config.recordPath.empty() && config.iterations > 0 && config.jobs > 0 &&
+        uint64_t(config.iterations) * config.jobs > UINT16_MAX + 1ULL) {
+        throw invalid_argument("-record supports up to " +
+            to_string(UINT16_MAX + 1) + " files (iterations times jobs)");
+    }
+    if (!config.replayPath.empty() && (config.metaFiles || config.verify ||
+        config.bufferMax || !config.recordPath.empty())) {
+        throw invalid_argument("-replay cannot be combined with -meta, -verify, "
+            "a buffer size sweep or -record");
+    }
+    if (config.bufferMax && (config.blockSize || config.metaFiles)) {
+        throw invalid_argument("a buffer size sweep sets the block size, it "
+            "cannot be combined with -bs or -meta");
+    }
+    if (config.function != Func::PReadWriteV && (config.rwFlags ||
+        !config.iovSizes.empty())) {
+        throw invalid_argument("iovecs and RWF flags are supported by the prwv "
+            "function only");
+    }
+    // explicit iovec sizes make up the block
+    if (!config.iovSizes.empty()) {
+        size_t total = accumulate(config.iovSizes.begin(),
+            config.iovSizes.end(), size_t(0));
+        if (config.blockSize && config.blockSize != total) {
+            throw invalid_argument("iovec sizes must add up to the block size");
+        }
+        config.blockSize = total;
+    }
+    if (config.zipfTheta <= 0 || config.zipfTheta >= 1) {
+        throw invalid_argument("Zipf theta must be between 0 and 1");
+    }
+    if (config.hotAccess < 0 || config.hotAccess > 100 || config.hotData <= 0 ||
+        config.hotData > 100) {
+        throw invalid_argument("hotspot percentages must be within 0..100");
+    }
+    if (config.verify && config.function == Func::Uring) {
+        throw invalid_argument("verification is not supported by the uring "
+            "function");
+    }
+    for (const auto &[reads, writes] : config.mixes) {
+        if (reads < 0 || writes < 0 || reads + writes == 0) {
+            throw invalid_argument("mix ratio parts must be non-negative");
+        }
+    }
+    if (!config.mixes.empty() && !(sync_engine ||
+        config.function == Func::Uring)) {
+        throw invalid_argument("-mix is supported by the rw, prw, prwv and "
+            "uring functions");
+    }
+    if (config.layout == Layout::Append && (!sync_engine ||
+        config.pattern != Pattern::Sequential ||
+        (config.sharedFile && config.jobs > 1) || !config.mixes.empty())) {
+        throw invalid_argument("append layout needs the rw, prw or prwv function, "
+            "the sequential pattern, a file per job and no mixed phase");
+    }
+    if (config.verify && !config.mixes.empty()) {
+        throw invalid_argument("verification is not supported in the mixed "
+            "phase");
+    }
+    if (config.warmup < 0 || config.trials < 1 || config.trials > MAX_TRIALS) {
+        throw invalid_argument("warmup must be non-negative and trials within "
+            "1.." + to_string(MAX_TRIALS));
+    }
+    if (config.ciTarget < 0 || config.budget < 0) {
+        throw invalid_argument("CI target and time budget cannot be negative");
+    }
+    if (config.queueDepth == 0) {
+        throw invalid_argument("queue depth must be positive");
+    }
+    if (config.strideSize > (config.maxSize - config.minSize)) {
+        throw invalid_argument("strideSize cannot be greater than (maxSize -"
+            " minSize)");
+    }
+
+    return config;
+}
+
+// Heap buffer with a fixed alignment, suitable for O_DIRECT transfers
+class AlignedBuffer {
+public:
+    AlignedBuffer(size_t size, size_t alignment)
+        : size_(size), capacity_(size) {
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, alignment, size) != 0) {
+            throw bad_alloc();
+        }
+        data_ = static_cast<unsigned char *>(ptr);
+    }
+    // View of memory owned elsewhere, e.g. by a BufferArena; `capacity`
+    // bytes from data() are usable, the -data pool behind the buffer
+    AlignedBuffer(unsigned char *data, size_t size, size_t capacity = 0)
+        : data_(data), size_(size), capacity_(max(size, capacity)),
+          owned_(false) {}
+    ~AlignedBuffer() {
+        if (owned_) {
+            free(data_);
+        }
+    }
+    AlignedBuffer(const AlignedBuffer &) = delete;
+    AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+    unsigned char *data() { return data_; }
+    const unsigned char *data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    unsigned char &operator[](size_t i) { return data_[i]; }
+    unsigned char operator[](size_t i) const { return data_[i]; }
+
+private:
+    unsigned char *data_ = nullptr;
+    size_t size_;
+    size_t capacity_;
+    bool owned_ = true;
+};
+
+// Huge page size of the system, 2M if /proc/meminfo does not tell
+size_t huge_page_size() {
+    ifstream meminfo("/proc/meminfo");
+    string key;
+    size_t kb;
+    while (meminfo >> key >> kb) {
+        if (key == "Hugepagesize:") {
+            return kb * 1024;
+        }
+        meminfo.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    return 2 << 20;
+}
+
+// Pin the calling thread to a set of CPUs
+void pin_thread(const vector<int> &cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+        throw string_view("pin_thread/sched_setaffinity");
+    }
+#else
+    (void)cpus;
+#endif
+}
+
+// The I/O buffers of all jobs for the whole run: one anonymous mapping with
+// a slot per job that fits the largest buffer of a sweep. The mapping can be
+// backed by huge pages and moved between NUMA nodes.
+class BufferArena {
+public:
+    BufferArena(size_t jobs, size_t slot_size, size_t alignment,
+        Hugepages hugepages)
+        : slot_((slot_size + alignment - 1) / alignment * alignment) {
+        size_t page = hugepages == Hugepages::Off ? sysconf(_SC_PAGESIZE) :
+            huge_page_size();
+        alignment = max(alignment, page);
+        size_ = (slot_ * jobs + page - 1) / page * page;
+        // room to align the start when the alignment is above the mmap one
+        mapped_ = size_ + (hugepages == Hugepages::Explicit ? 0 : alignment);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+        if (hugepages == Hugepages::Explicit) {
+            flags |= MAP_HUGETLB;
+        }
+#endif
+        base_ = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (base_ == MAP_FAILED) {
+            perror(hugepages == Hugepages::Explicit ? "mmap MAP_HUGETLB "
+                "(reserve pages with vm.nr_hugepages)" : "mmap");
+            throw string_view("BufferArena/mmap");
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(base_);
+        data_ = reinterpret_cast<unsigned char *>((start + alignment - 1) /
+            alignment * alignment);
+#ifdef MADV_HUGEPAGE
+        if (hugepages == Hugepages::Transparent &&
+            madvise(data_, size_, MADV_HUGEPAGE) != 0) {
+            perror("madvise MADV_HUGEPAGE");
+            munmap(base_, mapped_);
+            throw string_view("BufferArena/madvise");
+        }
+#endif
+        // fault the pages in now rather than inside the first phase
+        memset(data_, 0, size_);
+    }
+    ~BufferArena() {
+        munmap(base_, mapped_);
+    }
+    BufferArena(const BufferArena &) = delete;
+    BufferArena &operator=(const BufferArena &) = delete;
+
+    // The first size bytes of the slot of a job
+    unique_ptr<AlignedBuffer> slot(size_t job, size_t size,
+        size_t capacity = 0) {
+        return make_unique<AlignedBuffer>(data_ + job * slot_, size, capacity);
+    }
+
+    // Bind the buffers to a NUMA node, migrating the pages already there.
+    // A kernel without NUMA support leaves them where they are.
+    void place(int node) {
+#ifdef HAVE_MEMPOLICY
+        unsigned long mask = 1UL << node;
+        if (syscall(SYS_mbind, data_, size_, MPOL_BIND, &mask, sizeof(mask) * 8,
+            MPOL_MF_MOVE | MPOL_MF_STRICT) != 0) {
+            if (errno == ENOSYS) {
+                cerr << "NUMA placement is not supported by the kernel" << endl;
+                return;
+            }
+            perror("mbind");
+            throw string_view("BufferArena/mbind");
+        }
+#else
+        (void)node;
+#endif
+    }
+
+    // NUMA node of the first buffer page, -1 if unknown
+    int node() const {
+        int node = -1;
+#ifdef HAVE_MEMPOLICY
+        if (syscall(SYS_get_mempolicy, &node, nullptr, 0, data_,
+            MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+            return -1;
+        }
+#endif
+        return node;
+    }
+
+private:
+    size_t slot_;
+    size_t size_;
+    size_t mapped_;
+    void *base_;
+    unsigned char *data_;
+};
+
+// Alignment required for O_DIRECT transfers on the filesystem holding `path`:
+// the logical block size of the backing device, 512 B if it is unknown
+size_t direct_io_alignment(const string &path) {
+    size_t alignment = 512;
+#ifdef __linux__
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return alignment;
+    }
+    string dev = "/sys/dev/block/" + to_string(major(st.st_dev)) + ":" +
+        to_string(minor(st.st_dev));
+    // a partition keeps the queue attributes in its parent device
+    for (const char *queue : {"/queue/logical_block_size",
+        "/../queue/logical_block_size"}) {
+        ifstream in(dev + queue);
+        size_t value = 0;
+        if (in >> value && value > 0) {
+            alignment = value;
+            break;
+        }
+    }
+#endif
+    return alignment;
+}
+
+// Name of the block device holding `path` as /proc/diskstats lists it,
+// empty for memory filesystems and on macOS
+string block_device(const string &path) {
+#ifdef __linux__
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && major(st.st_dev) != 0) {
+        error_code ec;
+        auto target = fs::canonical("/sys/dev/block/" +
+            to_string(major(st.st_dev)) + ":" + to_string(minor(st.st_dev)), ec);
+        if (!ec) {
+            return target.filename().string();
+        }
+    }
+#else
+    (void)path;
+#endif
+    return "";
+}
+
+// NUMA node of the device holding `path`, -1 if unknown or not NUMA
+int device_numa_node(const string &path) {
+    int node = -1;
+#ifdef __linux__
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || major(st.st_dev) == 0) {
+        return node;
+    }
+    string dev = "/sys/dev/block/" + to_string(major(st.st_dev)) + ":" +
+        to_string(minor(st.st_dev));
+    // an NVMe namespace links to its controller, the PCI function is below it;
+    // a partition keeps the device attributes in its parent
+    for (const char *attribute : {"/device/numa_node", "/device/device/numa_node",
+        "/../device/numa_node", "/../device/device/numa_node"}) {
+        ifstream in(dev + attribute);
+        if (in >> node) {
+            break;
+        }
+    }
+#endif
+    return node;
+}
+
+// Open a file, bypassing the page cache if `direct` is set: O_DIRECT on Linux,
+// F_NOCACHE on macOS. Filesystems which reject O_DIRECT (e.g. tmpfs) fall back
+// to buffered I/O with a warning.
+int open_file(const string &filename, int flags, bool direct) {
+#ifdef O_DIRECT
+    if (direct) {
+        int fd = open(filename.c_str(), flags | O_DIRECT, 0644);
+        if (fd >= 0 || errno != EINVAL) {
+            return fd;
+        }
+        static bool warned = false;
+        if (!warned) {
+            cerr << "Warning: O_DIRECT is not supported by the filesystem, "
+                "using buffered I/O\n";
+            warned = true;
+        }
+    }
+    return open(filename.c_str(), flags, 0644);
+#else
+    int fd = open(filename.c_str(), flags, 0644);
+    if (fd >= 0 && direct) {
+        fcntl(fd, F_NOCACHE, 1);
+    }
+    return fd;
+#endif
+}
+
+// Flush a file and drop its pages from the page cache, so the following
+// read phase is served by the device
+void evict_file_cache(const string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror("open evict");
+        return;
+    }
+#ifdef __linux__
+    if (fdatasync(fd) != 0) {
+        perror("fdatasync");
+    }
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0) {
+        perror("posix_fadvise");
+    }
+#else
+    fsync(fd);
+#endif
+    close(fd);
+}
+
+// A region of a file handled by one engine call. With several jobs on one
+// shared file every job gets a disjoint region, and the file is created
+// with its full size before the jobs start.
+struct IoTask {
+    string filename;
+    size_t offset = 0;       // start of the region in the file
+    size_t size = 0;         // length of the region
+    bool sharedFile = false; // other jobs work on the same file
+    uint64_t seed = 0;       // seed of the offset generator
+    double writeShare = 0;   // mixed phase: probability of a write
+    uint16_t slot = 0;       // index of the file in the step, -record
+    double zipfZeta = 0;     // zeta of the region's blocks, set by make_tasks
+};
+
+// One operation of an I/O trace, -record and -replay. A trace file is
+// TRACE_MAGIC followed by the records in timestamp order, in host byte order.
+enum class TraceOp : uint8_t { Read, Write, Fsync };
+
+constexpr uint8_t TRACE_SYNC = 1;  // flag: fdatasync after the write
+constexpr char TRACE_MAGIC[8] = {'D', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+
+struct TraceRecord {
+    uint64_t timestampNs;    // from the start of the trace
+    uint64_t offset;
+    uint32_t length;
+    uint16_t slot;           // file and stream of the operation
+    TraceOp op;
+    uint8_t flags;
+};
+static_assert(sizeof(TraceRecord) == 24, "trace records are 24 bytes");
+
+// I/O size of the prw, mm and uring engines
+size_t block_size(const Config &config) {
+    return config.blockSize ? config.blockSize : config.bufferSize;
+}
+
+// zeta(n, theta) = sum of 1 / i^theta over i = 1..n, the normalization of
+// a Zipf distribution over n blocks. O(n) calls of pow(), so make_tasks
+// computes it once per region size before the phases start.
+double zipf_zeta(size_t blocks, double theta) {
+    double zeta = 0;
+    for (size_t i = 1; i <= blocks; ++i) {
+        zeta += 1.0 / pow(double(i), theta);
+    }
+    return zeta;
+}
+
+// Reproducible generator of block offsets within a task region. The whole
+// state is set up by the constructor, next() neither allocates nor calls
+// into the system.
+class OffsetGenerator {
+public:
+    OffsetGenerator(const Config &config, const IoTask &task)
+        : pattern_(config.pattern), base_(task.offset),
+          block_(block_size(config)), blocks_(task.size / block_size(config)) {
+        // splitmix64 expands the seed into the xoshiro256** state
+        uint64_t x = task.seed;
+        for (auto &word : state_) {
+            x += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+        if (pattern_ == Pattern::Zipf) {
+            // Gray et al., "Quickly generating billion-record synthetic
+            // databases", as used by YCSB
+            theta_ = config.zipfTheta;
+            double zeta2 = 1.0 + pow(0.5, theta_);
+            zetan_ = task.zipfZeta > 0 ? task.zipfZeta :
+                zipf_zeta(blocks_, theta_);
+            alpha_ = 1.0 / (1.0 - theta_);
+            eta_ = (1.0 - pow(2.0 / blocks_, 1.0 - theta_)) /
+                (1.0 - zeta2 / zetan_);
+            // the Knuth multiplier made coprime with the block count, so
+            // rank -> rank * scramble_ mod blocks_ is a permutation
+            scramble_ = 0x9e3779b97f4a7c15ULL % blocks_;
+            while (gcd(scramble_, blocks_) != 1) {
+                ++scramble_;
+            }
+        }
+        hotBlocks_ = max<size_t>(1, blocks_ * config.hotData / 100);
+        hotAccess_ = config.hotAccess / 100.0;
+    }
+
+    // Number of operations in one pass over the region
+    size_t count() const { return blocks_; }
+
+    // File offset of the next operation
+    size_t next() {
+        switch (pattern_) {
+        case Pattern::Random:
+            return next_as<Pattern::Random>();
+        case Pattern::Zipf:
+            return next_as<Pattern::Zipf>();
+        case Pattern::Hotspot:
+            return next_as<Pattern::Hotspot>();
+        default:
+            return next_as<Pattern::Sequential>();
+        }
+    }
+
+    // Whether the next operation of a mixed phase is a write, drawn from the
+    // seeded stream of the offsets
+    bool chance(double probability) { return uniform() < probability; }
+
+    // next() for a pattern fixed at compile time, as the engine loops use it
+    template <Pattern P>
+    size_t next_as() {
+        size_t block = 0;
+        if constexpr (P == Pattern::Sequential) {
+            block = seq_++ % blocks_;
+        }
+        else if constexpr (P == Pattern::Random) {
+            block = rand64() % blocks_;
+        }
+        else if constexpr (P == Pattern::Zipf) {
+            double u = uniform();
+            double uz = u * zetan_;
+            if (uz < 1.0) {
+                block = 0;
+            }
+            else if (uz < 1.0 + pow(0.5, theta_)) {
+                block = 1;
+            }
+            else {
+                block = static_cast<size_t>(blocks_ *
+                    pow(eta_ * u - eta_ + 1.0, alpha_));
+            }
+            // scatter the ranks over the region, the hot blocks would
+            // otherwise be one sequential run at its start
+            block = static_cast<size_t>(static_cast<unsigned __int128>(
+                min(block, blocks_ - 1)) * scramble_ % blocks_);
+        }
+        else {
+            if (uniform() < hotAccess_ || hotBlocks_ == blocks_) {
+                block = rand64() % hotBlocks_;
+            }
+            else {
+                block = hotBlocks_ + rand64() % (blocks_ - hotBlocks_);
+            }
+        }
+        return base_ + block * block_;
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    // xoshiro256**
+    uint64_t rand64() {
+        uint64_t result = rotl(state_[1] * 5, 7) * 9;
+        uint64_t t = state_[1] << 17;
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = rotl(state_[3], 45);
+        return result;
+    }
+
+    // uniform double in [0, 1)
+    double uniform() { return (rand64() >> 11) * 0x1.0p-53; }
+
+    Pattern pattern_;
+    size_t base_;
+    size_t block_;
+    size_t blocks_;
+    size_t seq_ = 0;
+    uint64_t state_[4];
+    double theta_ = 0, zetan_ = 0, alpha_ = 0, eta_ = 0;
+    size_t scramble_ = 1;   // Zipf: multiplier from rank to block
+    size_t hotBlocks_;
+    double hotAccess_;
+};
+
+// Monotonic time in nanoseconds (clock_gettime through the vDSO on Linux)
+inline uint64_t now_ns() {
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Sleep most of the wait for a now_ns() time and spin the rest. Returns the
+// time it got back, the deadline or later.
+uint64_t wait_until(uint64_t due) {
+    uint64_t now = now_ns();
+    if (due > now + 200000) {
+        this_thread::sleep_for(nanoseconds(due - now - 100000));
+    }
+    while ((now = now_ns()) < due) {
+    }
+    return now;
+}
+
+// Latency histogram of fixed size with logarithmic buckets, HDR-style: every
+// power of two range is split into SUB_COUNT linear sub-buckets, which keeps
+// the relative error of a value within 1 / SUB_COUNT. Every job records into
+// its own histogram, they are merged when the phase is over.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr size_t SUB_COUNT = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    void record(uint64_t ns) {
+        ++counts_[index(ns)];
+        ++count_;
+        if (ns > max_) {
+            max_ = ns;
+        }
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        max_ = max(max_, other.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t maxValue() const { return max_; }
+
+    // Value below which the `q` fraction of the samples falls (0 < q <= 1)
+    uint64_t percentile(double q) const {
+        uint64_t rank = static_cast<uint64_t>(ceil(q * count_));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank && seen > 0) {
+                return min(value(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static size_t index(uint64_t v) {
+        if (v < SUB_COUNT) {
+            return v;
+        }
+        int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + ((v >> shift) - SUB_COUNT);
+    }
+
+    // largest value of a bucket
+    static uint64_t value(size_t i) {
+        if (i < SUB_COUNT) {
+            return i;
+        }
+        size_t shift = i / SUB_COUNT - 1;
+        uint64_t sub = i % SUB_COUNT + SUB_COUNT;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    array<uint64_t, BUCKETS> counts_{};
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+};
+
+// Resource usage of the calling thread, getrusage
+struct ThreadUsage {
+    uint64_t userNs = 0;
+    uint64_t systemNs = 0;
+    uint64_t majorFaults = 0;
+    uint64_t minorFaults = 0;
+    uint64_t voluntarySwitches = 0;   // blocked, e.g. waiting for I/O
+    uint64_t involuntarySwitches = 0; // preempted
+
+    ThreadUsage &operator+=(const ThreadUsage &other) {
+        userNs += other.userNs;
+        systemNs += other.systemNs;
+        majorFaults += other.majorFaults;
+        minorFaults += other.minorFaults;
+        voluntarySwitches += other.voluntarySwitches;
+        involuntarySwitches += other.involuntarySwitches;
+        return *this;
+    }
+    ThreadUsage operator-(const ThreadUsage &other) const {
+        ThreadUsage delta;
+        delta.userNs = userNs - other.userNs;
+        delta.systemNs = systemNs - other.systemNs;
+        delta.majorFaults = majorFaults - other.majorFaults;
+        delta.minorFaults = minorFaults - other.minorFaults;
+        delta.voluntarySwitches = voluntarySwitches - other.voluntarySwitches;
+        delta.involuntarySwitches = involuntarySwitches - other.involuntarySwitches;
+        return delta;
+    }
+};
+
+ThreadUsage thread_usage() {
+    rusage usage;
+#ifdef RUSAGE_THREAD
+    getrusage(RUSAGE_THREAD, &usage);
+#else
+    getrusage(RUSAGE_SELF, &usage);
+#endif
+    ThreadUsage result;
+    result.userNs = usage.ru_utime.tv_sec * 1000000000ULL +
+        usage.ru_utime.tv_usec * 1000ULL;
+    result.systemNs = usage.ru_stime.tv_sec * 1000000000ULL +
+        usage.ru_stime.tv_usec * 1000ULL;
+    result.majorFaults = usage.ru_majflt;
+    result.minorFaults = usage.ru_minflt;
+    result.voluntarySwitches = usage.ru_nvcsw;
+    result.involuntarySwitches = usage.ru_nivcsw;
+    return result;
+}
+
+// Counters of the calling thread from perf_event_open: CPU cycles,
+// instructions and cache misses, the task clock and CPU migrations.
+// A counter the kernel, the CPU or perf_event_paranoid does not allow
+// reads as -1.
+constexpr size_t PERF_COUNTERS = 5;
+const char *const PERF_NAMES[PERF_COUNTERS] = {"cycles", "instructions",
+    "cacheMisses", "taskClockNs", "cpuMigrations"};
+using PerfValues = array<int64_t, PERF_COUNTERS>;
+
+class PerfCounters {
+public:
+    PerfCounters() {
+        fds_.fill(-1);
+#ifdef HAVE_PERF_EVENT
+        const pair<uint32_t, uint64_t> events[PERF_COUNTERS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS}};
+        for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.disabled = 1;
+            attr.exclude_hv = 1;
+            // the kernel side of the I/O is counted too
+            fds_[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+    ~PerfCounters() {
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    void start() {
+#ifdef HAVE_PERF_EVENT
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    // Counts since start()
+    PerfValues stop() {
+        PerfValues values;
+        values.fill(-1);
+#ifdef HAVE_PERF_EVENT
+        for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+            uint64_t count;
+            if (fds_[i] >= 0 && ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0) == 0 &&
+                read(fds_[i], &count, sizeof(count)) == sizeof(count)) {
+                values[i] = count;
+            }
+        }
+#endif
+        return values;
+    }
+
+private:
+    array<int, PERF_COUNTERS> fds_;
+};
+
+// Sum of the counters of the jobs, -1 unless every job had the counter
+void add_perf(PerfValues &total, const PerfValues &job, bool first) {
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        total[i] = job[i] < 0 || (!first && total[i] < 0) ? -1 :
+            (first ? 0 : total[i]) + job[i];
+    }
+}
+
+// I/O of the whole process, /proc/self/io: bytes passed through read and
+// write calls and bytes that reached the storage layer
+struct ProcessIo {
+    bool valid = false;
+    uint64_t readChars = 0;
+    uint64_t writeChars = 0;
+    uint64_t readCalls = 0;
+    uint64_t writeCalls = 0;
+    uint64_t readBytes = 0;
+    uint64_t writeBytes = 0;
+};
+
+ProcessIo process_io() {
+    ProcessIo io;
+    ifstream in("/proc/self/io");
+    string key;
+    uint64_t value;
+    pair<const char *, uint64_t ProcessIo::*> fields[] = {
+        {"rchar:", &ProcessIo::readChars}, {"wchar:", &ProcessIo::writeChars},
+        {"syscr:", &ProcessIo::readCalls}, {"syscw:", &ProcessIo::writeCalls},
+        {"read_bytes:", &ProcessIo::readBytes},
+        {"write_bytes:", &ProcessIo::writeBytes}};
+    while (in >> key >> value) {
+        for (const auto &[name, field] : fields) {
+            if (key == name) {
+                io.*field = value;
+                io.valid = true;
+            }
+        }
+    }
+    return io;
+}
+
+// Requests the device completed, /proc/diskstats. Sectors are 512 B.
+struct DiskStats {
+    bool valid = false;
+    uint64_t reads = 0;
+    uint64_t readMerges = 0;
+    uint64_t readSectors = 0;
+    uint64_t writes = 0;
+    uint64_t writeMerges = 0;
+    uint64_t writeSectors = 0;
+};
+
+DiskStats disk_stats(const string &device) {
+    DiskStats stats;
+    ifstream in("/proc/diskstats");
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        unsigned major, minor;
+        string name;
+        uint64_t read_ms, write_ms;
+        if (fields >> major >> minor >> name && name == device &&
+            fields >> stats.reads >> stats.readMerges >> stats.readSectors >>
+            read_ms >> stats.writes >> stats.writeMerges >> stats.writeSectors >>
+            write_ms) {
+            stats.valid = true;
+            break;
+        }
+    }
+    return stats;
+}
+
+// Process and device I/O during a phase
+struct IoCounters {
+    ProcessIo process;
+    DiskStats disk;
+
+    IoCounters operator-(const IoCounters &before) const {
+        IoCounters delta;
+        delta.process.valid = process.valid && before.process.valid;
+        delta.process.readChars = process.readChars - before.process.readChars;
+        delta.process.writeChars = process.writeChars - before.process.writeChars;
+        delta.process.readCalls = process.readCalls - before.process.readCalls;
+        delta.process.writeCalls = process.writeCalls - before.process.writeCalls;
+        delta.process.readBytes = process.readBytes - before.process.readBytes;
+        delta.process.writeBytes = process.writeBytes - before.process.writeBytes;
+        delta.disk.valid = disk.valid && before.disk.valid;
+        delta.disk.reads = disk.reads - before.disk.reads;
+        delta.disk.readMerges = disk.readMerges - before.disk.readMerges;
+        delta.disk.readSectors = disk.readSectors - before.disk.readSectors;
+        delta.disk.writes = disk.writes - before.disk.writes;
+        delta.disk.writeMerges = disk.writeMerges - before.disk.writeMerges;
+        delta.disk.writeSectors = disk.writeSectors - before.disk.writeSectors;
+        return delta;
+    }
+    IoCounters &operator+=(const IoCounters &other) {
+        process.valid = process.valid && other.process.valid;
+        process.readChars += other.process.readChars;
+        process.writeChars += other.process.writeChars;
+        process.readCalls += other.process.readCalls;
+        process.writeCalls += other.process.writeCalls;
+        process.readBytes += other.process.readBytes;
+        process.writeBytes += other.process.writeBytes;
+        disk.valid = disk.valid && other.disk.valid;
+        disk.reads += other.disk.reads;
+        disk.readMerges += other.disk.readMerges;
+        disk.readSectors += other.disk.readSectors;
+        disk.writes += other.disk.writes;
+        disk.writeMerges += other.disk.writeMerges;
+        disk.writeSectors += other.disk.writeSectors;
+        return *this;
+    }
+};
+
+IoCounters io_counters(const string &device) {
+    return {process_io(), device.empty() ? DiskStats() : disk_stats(device)};
+}
+
+// Per-job measurements collected by the engines
+struct JobStats {
+    LatencyHistogram latency; // one sample per I/O call
+    LatencyHistogram commit;  // one sample per commit, -sync
+    uint64_t verifyNs = 0;    // spent stamping and checking blocks
+    uint64_t verifiedBlocks = 0;
+    uint64_t corruptBlocks = 0;
+    string firstError;
+    ThreadUsage usage;        // of the job's thread during the phase
+    PerfValues perf;
+    uint64_t nowaitAgain = 0; // RWF_NOWAIT calls failed with EAGAIN
+    uint64_t nowaitShort = 0; // RWF_NOWAIT calls cut short
+    atomic<uint64_t> bytesDone{0}; // read by the sampler thread
+    bool recording = false;   // -record: keep every operation in trace
+    vector<TraceRecord> trace;
+    uint64_t lagNs = 0;       // replay: most an operation started late
+    uint64_t dataSequence = 0; // writes taken from the DataCursor
+    LatencyHistogram writeLatency; // mixed phase: the writes, latency the reads
+    uint64_t writtenBytes = 0;    // mixed phase
+    uint64_t intervalNs = 0;  // -rate: between intended starts, 0 - closed loop
+    uint64_t intendedNs = 0;  // -rate: start of the next operation
+    LatencyHistogram service; // -rate: the I/O calls alone
+
+    // Called by the engines after every I/O. Only the job's own thread
+    // writes the counter, so a relaxed store is enough.
+    void progress(size_t bytes) {
+        bytesDone.store(bytesDone.load(memory_order_relaxed) + bytes,
+            memory_order_relaxed);
+    }
+};
+
+// Fixed-capacity ring of (seconds, bytes done) samples. Once it is full the
+// oldest samples are overwritten.
+class SampleRing {
+public:
+    explicit SampleRing(size_t capacity) : samples_(capacity) {}
+
+    void push(double seconds, uint64_t bytes) {
+        samples_[next_ % samples_.size()] = {seconds, bytes};
+        ++next_;
+    }
+
+    // Oldest first
+    vector<pair<double, uint64_t>> ordered() const {
+        vector<pair<double, uint64_t>> result;
+        size_t count = min(next_, samples_.size());
+        for (size_t i = next_ - count; i < next_; ++i) {
+            result.push_back(samples_[i % samples_.size()]);
+        }
+        return result;
+    }
+
+    // Whether the oldest samples have been overwritten
+    bool wrapped() const { return next_ > samples_.size(); }
+
+private:
+    vector<pair<double, uint64_t>> samples_;
+    size_t next_ = 0;
+};
+
+constexpr size_t SAMPLE_CAPACITY = 16384;
+
+// ---- Data integrity ----
+// With -verify every I/O block starts with a header stamped by the writer:
+// magic, checksum, offset of the block, write sequence number and the seed
+// of the task; the rest of the block is a seed-derived pattern. The checksum
+// covers everything after itself, so readers detect corrupted, torn and
+// misplaced blocks.
+struct BlockHeader {
+    uint32_t magic;
+    uint32_t checksum;
+    uint64_t offset;
+    uint64_t sequence;
+    uint64_t seed;
+};
+
+constexpr uint32_t BLOCK_MAGIC = 0x4b4c4244; // "DBLK"
+
+// CRC32C (Castagnoli) lookup table for CPUs without a CRC instruction
+const array<uint32_t, 256> &crc32c_table() {
+    static const array<uint32_t, 256> table = [] {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+            }
+            t[i] = crc;
+        }
+        return t;
+    }();
+    return table;
+}
+
+uint32_t crc32c_scalar(uint32_t crc, const uint8_t *data, size_t size) {
+    const auto &table = crc32c_table();
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t size) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; --size, ++data) {
+        crc = __builtin_ia32_crc32qi(crc, *data);
+    }
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; --size, ++data) {
+        crc = __crc32cb(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t size) {
+#if defined(__x86_64__)
+    static const bool hw = __builtin_cpu_supports("sse4.2");
+    return hw ? crc32c_hw(crc, data, size) : crc32c_scalar(crc, data, size);
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return crc32c_hw(crc, data, size);
+#else
+    return crc32c_scalar(crc, data, size);
+#endif
+}
+
+constexpr size_t CRC_LANES = 4;
+
+// CRC32C of CRC_LANES consecutive lanes of `lane` bytes, a multiple of 8.
+// Every step takes one word of each lane: the lanes are independent
+// dependency chains, so the CPU overlaps the latency of their CRC
+// instructions.
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+void crc32c_lanes_hw(uint32_t *crc, const uint8_t *data, size_t lane) {
+    uint64_t c0 = crc[0], c1 = crc[1], c2 = crc[2], c3 = crc[3];
+    for (size_t pos = 0; pos < lane; pos += 8) {
+        uint64_t w0, w1, w2, w3;
+        memcpy(&w0, data + pos, 8);
+        memcpy(&w1, data + lane + pos, 8);
+        memcpy(&w2, data + 2 * lane + pos, 8);
+        memcpy(&w3, data + 3 * lane + pos, 8);
+        c0 = __builtin_ia32_crc32di(c0, w0);
+        c1 = __builtin_ia32_crc32di(c1, w1);
+        c2 = __builtin_ia32_crc32di(c2, w2);
+        c3 = __builtin_ia32_crc32di(c3, w3);
+    }
+    crc[0] = static_cast<uint32_t>(c0);
+    crc[1] = static_cast<uint32_t>(c1);
+    crc[2] = static_cast<uint32_t>(c2);
+    crc[3] = static_cast<uint32_t>(c3);
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+void crc32c_lanes_hw(uint32_t *crc, const uint8_t *data, size_t lane) {
+    uint32_t c0 = crc[0], c1 = crc[1], c2 = crc[2], c3 = crc[3];
+    for (size_t pos = 0; pos < lane; pos += 8) {
+        uint64_t w0, w1, w2, w3;
+        memcpy(&w0, data + pos, 8);
+        memcpy(&w1, data + lane + pos, 8);
+        memcpy(&w2, data + 2 * lane + pos, 8);
+        memcpy(&w3, data + 3 * lane + pos, 8);
+        c0 = __crc32cd(c0, w0);
+        c1 = __crc32cd(c1, w1);
+        c2 = __crc32cd(c2, w2);
+        c3 = __crc32cd(c3, w3);
+    }
+    crc[0] = c0;
+    crc[1] = c1;
+    crc[2] = c2;
+    crc[3] = c3;
+}
+#endif
+
+void crc32c_lanes(uint32_t *crc, const uint8_t *data, size_t lane) {
+#if defined(__x86_64__)
+    static const bool hw = __builtin_cpu_supports("sse4.2");
+    if (hw) {
+        crc32c_lanes_hw(crc, data, lane);
+        return;
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crc32c_lanes_hw(crc, data, lane);
+    return;
+#endif
+    for (size_t k = 0; k < CRC_LANES; ++k) {
+        crc[k] = crc32c_scalar(crc[k], data + k * lane, lane);
+    }
+}
+
+// Block checksum: CRC32C of four lanes, computed together by crc32c_lanes
+// and folded by a final CRC32C
+uint32_t block_checksum(const uint8_t *data, size_t size) {
+    size_t lane = size / CRC_LANES / 8 * 8;
+    uint32_t crc[CRC_LANES] = {~0u, ~0u, ~0u, ~0u};
+    crc32c_lanes(crc, data, lane);
+    crc[0] = crc32c(crc[0], data + CRC_LANES * lane, size - CRC_LANES * lane);
+    return ~crc32c(~0u, reinterpret_cast<const uint8_t *>(crc), sizeof(crc));
+}
+
+// Unit of compression and deduplication of -data: compressors and dedup
+// engines work on 4 KiB or larger pieces
+constexpr size_t DATA_CHUNK = 4096;
+
+// splitmix64 finalizer, a hash of one word
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Incompressible bytes from four interleaved xoshiro256** generators. The
+// lanes are independent and their multipliers are shifts and adds, so the
+// compiler vectorizes the inner loop.
+void fill_random(uint8_t *data, size_t size, uint64_t seed) {
+    constexpr size_t LANES = 4;
+    uint64_t state[4][LANES];
+    uint64_t x = seed;
+    for (auto &word : state) {
+        for (size_t k = 0; k < LANES; ++k) {
+            x += 0x9e3779b97f4a7c15ULL;
+            word[k] = mix64(x);
+        }
+    }
+    auto rotl = [](uint64_t v, int k) { return (v << k) | (v >> (64 - k)); };
+    uint64_t out[LANES];
+    for (size_t i = 0; i < size; i += sizeof(out)) {
+        for (size_t k = 0; k < LANES; ++k) {
+            out[k] = rotl(state[1][k] * 5, 7) * 9;
+            uint64_t t = state[1][k] << 17;
+            state[2][k] ^= state[0][k];
+            state[3][k] ^= state[1][k];
+            state[1][k] ^= state[2][k];
+            state[0][k] ^= state[3][k];
+            state[2][k] ^= t;
+            state[3][k] = rotl(state[3][k], 45);
+        }
+        memcpy(data + i, out, min(sizeof(out), size - i));
+    }
+}
+
+// Write data pool of a job for random data, refilled before every write
+// phase: every write takes its own window of it, so neighbouring blocks
+// differ throughout and not only in their tags
+constexpr size_t DATA_POOL = 8 << 20;
+
+// Bytes usable from the buffer of a job: for random data the buffer itself,
+// left to the reads, and the pool behind it with room for the duplicate
+// window of dedup and a window per io_uring request in flight
+size_t data_pool_size(const Config &config) {
+    size_t buffer = max(config.bufferSize, block_size(config));
+    if (config.data.base != DataBase::Random) {
+        return buffer;
+    }
+    size_t pool = max(DATA_POOL, 3 * buffer);
+    if (config.function == Func::Uring) {
+        pool = max(pool, (config.queueDepth + 2) * buffer);
+    }
+    return (pool + buffer - 1) / buffer * buffer;
+}
+
+// Fill the write data of a job, the whole pool, before the phase starts.
+// With a compression ratio every chunk is a random head followed by zeros.
+void fill_data(AlignedBuffer &buffer, const DataPattern &data, uint64_t seed) {
+    switch (data.base) {
+    case DataBase::Zero:
+        memset(buffer.data(), 0, buffer.capacity());
+        return;
+    case DataBase::Fill:
+        memset(buffer.data(), 0x55, buffer.capacity());
+        return;
+    case DataBase::Random:
+        break;
+    }
+    fill_random(buffer.data(), buffer.capacity(), seed);
+    size_t head = max<size_t>(8, static_cast<size_t>(DATA_CHUNK / data.compress));
+    for (size_t chunk = 0; head < DATA_CHUNK && chunk < buffer.capacity();
+        chunk += DATA_CHUNK) {
+        size_t end = min(chunk + DATA_CHUNK, buffer.capacity());
+        if (chunk + head < end) {
+            memset(buffer.data() + chunk + head, 0, end - chunk - head);
+        }
+    }
+}
+
+// Source of the written blocks of a job. For random data the writes go
+// round the block-sized windows of the pool after the first block, which
+// the reads use, and rewrite the first 8 bytes
+// of every 4 KiB chunk of theirs, so a window reused a pool later is still
+// a new block. With -data=dedup the blocks that are not unique all come from
+// the last window, tagged once and never changed, so they are identical and
+// safe to write from while in flight. Other data is written from the buffer.
+class DataCursor {
+public:
+    DataCursor(AlignedBuffer &buffer, size_t block, const DataPattern &data,
+        uint64_t seed)
+        : pool_(buffer.data()), block_(block), data_(data), seed_(seed) {
+        if (data.base != DataBase::Random) {
+            return;
+        }
+        // the first block is left to the reads when there is a pool
+        windows_ = max<size_t>(1, buffer.capacity() / block);
+        if (windows_ > 1) {
+            pool_ += block;
+            --windows_;
+        }
+        if (data.unique < 100 && windows_ > 1) {
+            --windows_;
+            tag(pool_ + windows_ * block_, block_, 0);
+        }
+    }
+
+    // Windows to rotate over, one for data that is not random
+    size_t windows() const { return windows_; }
+
+    // Data of the next write of up to a block
+    unsigned char *next(size_t size, JobStats &stats) {
+        return at(stats.dataSequence % windows_, size, stats);
+    }
+
+    // Data of the next write from a given window, for the engines that keep
+    // several writes in flight
+    unsigned char *at(size_t window, size_t size, JobStats &stats) {
+        if (data_.base != DataBase::Random) {
+            return pool_;
+        }
+        uint64_t key = mix64(seed_ ^ mix64(stats.dataSequence++));
+        if (data_.unique < 100 && key % 100 >= unsigned(data_.unique)) {
+            return pool_ + windows_ * block_;
+        }
+        unsigned char *block = pool_ + window * block_;
+        tag(block, size, key);
+        return block;
+    }
+
+private:
+    static void tag(unsigned char *block, size_t size, uint64_t key) {
+        for (size_t chunk = 0; chunk + 8 <= size; chunk += DATA_CHUNK) {
+            uint64_t tag = mix64(key + chunk);
+            memcpy(block + chunk, &tag, 8);
+        }
+    }
+
+    unsigned char *pool_;
+    size_t block_;
+    const DataPattern &data_;
+    uint64_t seed_;
+    size_t windows_ = 1;
+};
+
+// Stamp the header of a block which is about to be written at `offset`
+void stamp_block(uint8_t *block, size_t size, uint64_t offset,
+    uint64_t sequence, uint64_t seed, JobStats &stats) {
+    uint64_t start = now_ns();
+    BlockHeader header{BLOCK_MAGIC, 0, offset, sequence, seed};
+    memcpy(block, &header, sizeof(header));
+    header.checksum = block_checksum(block + 8, size - 8);
+    memcpy(block + 4, &header.checksum, 4);
+    stats.verifyNs += now_ns() - start;
+}
+
+// Check a block read from `offset`, last written as the `sequence`th write
+// of its pass
+void verify_block(const uint8_t *block, size_t size, uint64_t offset,
+    uint64_t sequence, uint64_t seed, JobStats &stats) {
+    uint64_t start = now_ns();
+    BlockHeader header;
+    memcpy(&header, block, sizeof(header));
+    const char *error = nullptr;
+    if (header.magic != BLOCK_MAGIC) {
+        error = "bad magic";
+    }
+    else if (header.offset != offset) {
+        error = "misplaced block";
+    }
+    else if (header.seed != seed) {
+        error = "stale block";
+    }
+    else if (header.checksum != block_checksum(block + 8, size - 8)) {
+        error = "checksum mismatch";
+    }
+    else if (header.sequence != sequence) {
+        error = "lost write";
+    }
+    ++stats.verifiedBlocks;
+    if (error) {
+        if (stats.corruptBlocks++ == 0) {
+            ostringstream oss;
+            oss << error << " at offset " << offset << " (header: offset " <<
+                header.offset << ", sequence " << header.sequence <<
+                ", expected " << sequence << ")";
+            stats.firstError = oss.str();
+        }
+    }
+    stats.verifyNs += now_ns() - start;
+}
+
+// Sequence numbers the readers expect by block of the task: the writers
+// stamp the index of the write within the pass, and a block a random
+// pattern writes more than once keeps the last one. The reads repeat the
+// offsets of the writes, so `offsets` is a generator of the read pass that
+// has not been advanced yet, drawing with the configured pattern.
+vector<size_t> write_sequences(OffsetGenerator offsets, const IoTask &task,
+    size_t block, JobStats &stats) {
+    uint64_t start = now_ns();
+    size_t count = offsets.count();
+    vector<size_t> sequences(count);
+    for (size_t i = 0; i < count; ++i) {
+        sequences[(offsets.next() - task.offset) / block] = i;
+    }
+    stats.verifyNs += now_ns() - start;
+    return sequences;
+}
+
+void fs_write_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+    ofstream file;
+    // a shared file or a laid out one is written in place, not truncated
+    if (task.sharedFile || config.layout != Layout::Fresh) {
+        file.open(task.filename, ios::binary | ios::in | ios::out);
+    }
+    else {
+        file.open(task.filename, ios::binary);
+    }
+    file.seekp(task.offset);
+    DataCursor source(buffer, buffer.size(), config.data, task.seed);
+    size_t written = 0;
+    while (written < task.size) {
+        size_t to_write = min(buffer.size(), task.size - written);
+        unsigned char *data = source.next(to_write, stats);
+        if (config.verify) {
+            stamp_block(data, buffer.size(),
+                task.offset + written, written / buffer.size(), task.seed, stats);
+        }
+        uint64_t start = now_ns();
+        file.write(reinterpret_cast<const char *>(data), to_write);
+        stats.latency.record(now_ns() - start);
+        stats.progress(to_write);
+        written += to_write;
+    }
+    file.close();
+}
+
+uint8_t fs_read_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+    ifstream file(task.filename, ios::binary);
+    file.seekg(task.offset);
+    uint8_t checksum = 0;
+    size_t read = 0;
+    while (read < task.size) {
+        size_t to_read = min(buffer.size(), task.size - read);
+        uint64_t start = now_ns();
+        file.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+        stats.latency.record(now_ns() - start);
+        stats.progress(to_read);
+        if (config.verify) {
+            verify_block(buffer.data(), buffer.size(), task.offset + read,
+                read / buffer.size(), task.seed, stats);
+        }
         read += to_read;
-        for(size_t i = 0; i < buffer.size(); i++) {
-            checksum ^= buffer[i];
+        checksum ^= buffer[0];
+    }
+    file.close();
+    return checksum;
+}
+
+// Map a task region with the mapping options of the config. The mapping has
+// to start at a page boundary, so `base` is set to the address of file
+// offset 0; pass `map` and `map_size` to munmap.
+void *map_region(int fd, const IoTask &task, const Config &config, bool write,
+    size_t &map_size, uint8_t *&base) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t map_offset = task.offset - task.offset % page;
+    map_size = task.offset + task.size - map_offset;
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (config.mmap.populate) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void *map = mmap(nullptr, map_size, write ? PROT_READ | PROT_WRITE :
+        PROT_READ, flags, fd, map_offset);
+    if (map == MAP_FAILED) {
+        return map;
+    }
+    base = static_cast<uint8_t *>(map) - map_offset;
+    if (config.mmap.sequential && madvise(map, map_size, MADV_SEQUENTIAL) != 0) {
+        perror("madvise MADV_SEQUENTIAL");
+    }
+    if (config.mmap.willneed && madvise(map, map_size, MADV_WILLNEED) != 0) {
+        perror("madvise MADV_WILLNEED");
+    }
+#ifdef MADV_HUGEPAGE
+    if (config.mmap.hugepage && madvise(map, map_size, MADV_HUGEPAGE) != 0) {
+        perror("madvise MADV_HUGEPAGE");
+    }
+#endif
+    if (config.mmap.prefault) {
+#if defined(MADV_POPULATE_READ) && defined(MADV_POPULATE_WRITE)
+        if (madvise(map, map_size, write ? MADV_POPULATE_WRITE :
+            MADV_POPULATE_READ) == 0) {
+            return map;
+        }
+#endif
+        // older kernels: touch every page
+        volatile uint8_t *ptr = static_cast<uint8_t *>(map);
+        for (size_t i = 0; i < map_size; i += page) {
+            if (write) {
+                ptr[i] = ptr[i];
+            }
+            else {
+                (void)ptr[i];
+            }
+        }
+    }
+    return map;
+}
+
+void mm_write_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+    // MMap write test
+    // Open a file ans set zero size, a shared file is already sized and a
+    // laid out one is kept as prepare_file left it
+    int flags = task.sharedFile || config.layout != Layout::Fresh ? O_RDWR :
+        O_RDWR | O_CREAT | O_TRUNC;
+    int fd = open(task.filename.c_str(), flags, 0644);
+    if (fd < 0) {
+        perror("open");
+        throw string_view("mm_write_file/open");
+    }
+
+#ifdef F_NOCACHE
+    // Caching off
+    if (config.directIO && fcntl(fd, F_NOCACHE, 1) < 0) {
+        perror("fcntl F_NOCACHE");
+        throw string_view("mm_write_file/fcntl");
+    }
+#endif
+    // Linux has no uncached mappings, the page cache is dropped between
+    // the phases instead
+
+    if (!task.sharedFile && ftruncate(fd, task.offset + task.size) != 0) {
+        perror("ftruncate");
+        close(fd);
+        throw string_view("mm_write_file/ftruncate");;
+    }
+    // mmap
+    size_t map_size;
+    uint8_t* base;
+    void* map = map_region(fd, task, config, true, map_size, base);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        throw string_view("mm_write_file/mmap");;
+    }
+    OffsetGenerator offsets(config, task);
+    size_t count = offsets.count();
+    size_t block = block_size(config);
+    const MmapPolicy &policy = config.mmap;
+    DataCursor source(buffer, block, config.data, task.seed);
+    size_t unsynced = 0;
+    // --- Write + msync ---
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = offsets.next();
+        uint8_t* curr_p = base + offset;
+        unsigned char *data = source.next(block, stats);
+        if (config.verify) {
+            stamp_block(data, block, offset, i, task.seed, stats);
+        }
+        uint64_t start = now_ns();
+        std::memcpy(curr_p, data, block);
+        // Synchronizing
+        int err = 0;
+        switch (policy.msync) {
+        case MsyncMode::Block:
+            err = msync(curr_p, block, MS_SYNC);
+            break;
+        case MsyncMode::Async:
+            err = msync(curr_p, block, MS_ASYNC);
+            break;
+        case MsyncMode::Every:
+            // the whole mapping: with random offsets the dirty blocks are
+            // scattered, msync writes back only the dirty pages anyway
+            unsynced += block;
+            if (unsynced >= policy.msyncEvery) {
+                err = msync(map, map_size, MS_SYNC);
+                unsynced = 0;
+            }
+            break;
+        case MsyncMode::End:
+            break;
+        }
+        if (err != 0) {
+            perror("msync");
+            throw string_view("mm_write_file/msync");;
+        }
+        stats.latency.record(now_ns() - start);
+        stats.progress(block);
+    }
+    if (policy.msync != MsyncMode::Block) {
+        uint64_t start = now_ns();
+        if (msync(map, map_size, MS_SYNC) != 0) {
+            perror("msync");
+            throw string_view("mm_write_file/msync");;
+        }
+        stats.latency.record(now_ns() - start);
+    }
+    munmap(map, map_size);
+    close(fd);
+}
+
+uint8_t mm_read_file(const IoTask &task, AlignedBuffer &,
+    const Config &config, JobStats &stats) {
+    // --- MMap Read ---
+    // Open a file
+    int fd = open(task.filename.c_str(), O_RDONLY, 0644);
+    if (fd < 0) {
+        perror("open");
+        throw string_view("mm_write_file/open");;
+    }
+#ifdef F_NOCACHE
+    // Caching off
+    if (config.directIO && fcntl(fd, F_NOCACHE, 1) < 0) {
+        perror("fcntl F_NOCACHE");
+        throw string_view("mm_write_file/fcntl");
+    }
+#endif
+    // mmap
+    size_t map_size;
+    uint8_t* base;
+    void* map = map_region(fd, task, config, false, map_size, base);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        throw string_view("mm_write_file/mmap");
+    }
+    OffsetGenerator offsets(config, task);
+    size_t count = offsets.count();
+    size_t block = block_size(config);
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint8_t checksum = 0;
+    vector<size_t> sequences;
+    if (config.verify) {
+        sequences = write_sequences(offsets, task, block, stats);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = offsets.next();
+        uint8_t* ptr = base + offset;
+        // touch every page, the page faults happen here
+        uint64_t start = now_ns();
+        for (size_t j = 0; j < block; j += page) {
+            checksum ^= ptr[j];
+        }
+        stats.latency.record(now_ns() - start);
+        stats.progress(block);
+        if (config.verify) {
+            verify_block(ptr, block, offset,
+                sequences[(offset - task.offset) / block], task.seed, stats);
+        }
+    }
+    munmap(map, map_size);
+    close(fd);
+    return checksum;
+}
+
+// Open flags of the rw, prw and prwv writers: the commit policy and layout
+int write_open_flags(const Config &config) {
+    int flags = O_CREAT | O_WRONLY;
+    if (config.sync.mode == SyncMode::DSync)
+        flags |= O_DSYNC;
+    if (config.sync.mode == SyncMode::Sync)
+        flags |= O_SYNC;
+    if (config.layout == Layout::Append)
+        flags |= O_APPEND;
+    return flags;
+}
+
+// Commits the writes of an engine by its -sync policy and records the
+// latency of every commit. With O_DSYNC and O_SYNC every write is a commit.
+class Committer {
+public:
+    Committer(int fd, const SyncPolicy &policy, JobStats &stats,
+        uint16_t slot) : fd_(fd), policy_(policy), stats_(stats), slot_(slot) {}
+
+    // Whether written() has anything to do, otherwise the writers skip it
+    static bool per_write(const SyncPolicy &policy) {
+        return policy.every || policy.mode == SyncMode::DSync ||
+            policy.mode == SyncMode::Sync;
+    }
+
+    // Called after every write with its range and latency
+    bool written(size_t offset, size_t size, uint64_t latency_ns) {
+        if (policy_.mode == SyncMode::DSync || policy_.mode == SyncMode::Sync) {
+            stats_.commit.record(latency_ns);
+            if (stats_.recording && !stats_.trace.empty()) {
+                stats_.trace.back().flags |= TRACE_SYNC;
+            }
+            return true;
+        }
+        if (policy_.every == 0) {
+            return true;
+        }
+        window_begin_ = min(window_begin_, offset);
+        window_end_ = max(window_end_, offset + size);
+        pending_ += size;
+        return pending_ < policy_.every || commit();
+    }
+
+    // Called once after the last write. The write-behind window of
+    // sync_file_range always ends with a full fdatasync: even when the last
+    // write completed a window, its writeback is still in flight.
+    bool finish() {
+        if (policy_.mode == SyncMode::End || policy_.mode == SyncMode::FileRange ||
+            pending_) {
+            return commit(true);
+        }
+        return true;
+    }
+
+private:
+    bool commit(bool last = false) {
+        uint64_t start = now_ns();
+        int err = 0;
+        switch (policy_.mode) {
+        case SyncMode::End:
+        case SyncMode::Fsync:
+            err = fsync(fd_);
+            break;
+        case SyncMode::Fdatasync:
+            err = fdatasync(fd_);
+            break;
+        case SyncMode::FileRange:
+#ifdef __linux__
+            if (last) {
+                err = fdatasync(fd_);
+                break;
+            }
+            // start the writeback of this window, then wait for the
+            // previous one, keeping one window in flight
+            err = sync_file_range(fd_, window_begin_,
+                window_end_ - window_begin_, SYNC_FILE_RANGE_WRITE);
+            if (!err && previous_end_ > previous_begin_) {
+                err = sync_file_range(fd_, previous_begin_,
+                    previous_end_ - previous_begin_,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+            }
+            previous_begin_ = window_begin_;
+            previous_end_ = window_end_;
+#endif
+            break;
+        default:
+            break;
+        }
+        if (err) {
+            perror("commit");
+            return false;
+        }
+        stats_.commit.record(now_ns() - start);
+        if (stats_.recording && policy_.mode != SyncMode::None) {
+            // -record: the commit as an operation of its own, over the
+            // window it covers (the whole file at the end)
+            bool window = window_end_ > window_begin_ && !last;
+            stats_.trace.push_back({start, window ? window_begin_ : 0,
+                static_cast<uint32_t>(window ? window_end_ - window_begin_ : 0),
+                slot_, TraceOp::Fsync, 0});
+        }
+        pending_ = 0;
+        window_begin_ = SIZE_MAX;
+        window_end_ = 0;
+        return true;
+    }
+
+    int fd_;
+    const SyncPolicy &policy_;
+    JobStats &stats_;
+    uint16_t slot_;               // -record: file of the commits
+    size_t pending_ = 0;          // bytes written since the last commit
+    size_t window_begin_ = SIZE_MAX;
+    size_t window_end_ = 0;
+    size_t previous_begin_ = 0;   // sync_file_range window in flight
+    size_t previous_end_ = 0;
+};
+
+#ifdef HAVE_PREADV2
+// Segments of one prwv call, consecutive in the buffer
+vector<iovec> make_iovecs(AlignedBuffer &buffer, const Config &config) {
+    size_t block = block_size(config);
+    vector<size_t> sizes = config.iovSizes;
+    if (sizes.empty()) {
+        // equal parts, the last one takes the remainder
+        sizes.assign(config.iovCount, block / config.iovCount);
+        sizes.back() += block % config.iovCount;
+    }
+    vector<iovec> iov(sizes.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        iov[i].iov_base = buffer.data() + offset;
+        iov[i].iov_len = sizes[i];
+        offset += sizes[i];
+    }
+    return iov;
+}
+
+// One vectored transfer of a block. With RWF_NOWAIT a call that would block
+// fails with EAGAIN or stops short; it is counted and the rest of the block
+// is transferred without the flag, as an application would do.
+bool prwv_transfer(int fd, const vector<iovec> &iov, size_t block,
+    size_t offset, int flags, bool write_op, JobStats &stats) {
+    auto transfer = [&](const iovec *vec, int count, size_t pos, int rwf) {
+        return write_op ? pwritev2(fd, vec, count, pos, rwf) :
+            preadv2(fd, vec, count, pos, rwf);
+    };
+    ssize_t done = transfer(iov.data(), iov.size(), offset, flags);
+    if (done < 0 && errno == EAGAIN && (flags & RWF_NOWAIT)) {
+        ++stats.nowaitAgain;
+        done = 0;
+    }
+    else if (done < 0) {
+        perror(write_op ? "pwritev2" : "preadv2");
+        return false;
+    }
+    else if ((size_t)done < block && (flags & RWF_NOWAIT)) {
+        ++stats.nowaitShort;
+    }
+    flags &= ~RWF_NOWAIT;
+    auto *base = static_cast<uint8_t *>(iov.front().iov_base);
+    while ((size_t)done < block) {
+        iovec rest = {base + done, block - done};
+        ssize_t n = transfer(&rest, 1, offset + done, flags);
+        if (n <= 0) {
+            perror(write_op ? "pwritev2" : "preadv2");
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+#else
+void prwv_write_file(const IoTask &, AlignedBuffer &, const Config &,
+    JobStats &) {
+    throw string_view("prwv_write_file/unsupported");
+}
+
+unsigned char prwv_read_file(const IoTask &, AlignedBuffer &, const Config &,
+    JobStats &) {
+    throw string_view("prwv_read_file/unsupported");
+}
+#endif
+
+// ---- File descriptor engines ----
+// read/write, pread/pwrite and preadv2/pwritev2 share one I/O loop. It is a
+// template over the engine, the access pattern, verification and whether the
+// sync policy looks at every write, so the per-operation path has no run-time
+// dispatch left. An engine is a class constructed once per file with
+//   NAME                       - error location prefix
+//   POSITIONED                 - honours the offsets of the access pattern
+//   write(offset, block, stats), read(offset, block, stats) - one transfer,
+//                                false with errno set on failure
+
+// Call f with a run-time value as a compile-time constant
+template <class F>
+auto with_pattern(Pattern pattern, F &&f) {
+    switch (pattern) {
+    case Pattern::Random:
+        return f(integral_constant<Pattern, Pattern::Random>());
+    case Pattern::Zipf:
+        return f(integral_constant<Pattern, Pattern::Zipf>());
+    case Pattern::Hotspot:
+        return f(integral_constant<Pattern, Pattern::Hotspot>());
+    default:
+        return f(integral_constant<Pattern, Pattern::Sequential>());
+    }
+}
+
+template <class F>
+auto with_flag(bool flag, F &&f) {
+    return flag ? f(true_type()) : f(false_type());
+}
+
+class RwEngine {
+public:
+    static constexpr const char *NAME = "rw";
+    static constexpr bool POSITIONED = false;
+
+    RwEngine(int fd, const IoTask &task, AlignedBuffer &buffer, const Config &)
+        : fd_(fd), data_(buffer.data()) {
+        if (lseek(fd, task.offset, SEEK_SET) < 0) {
+            perror("lseek");
+            throw string_view("RwEngine/lseek");
+        }
+    }
+    // Write data of the next write, the buffer until then
+    void source(unsigned char *data) { data_ = data; }
+    bool write(size_t, size_t block, JobStats &) {
+        return ::write(fd_, data_, block) == (ssize_t)block;
+    }
+    bool read(size_t, size_t block, JobStats &) {
+        return ::read(fd_, data_, block) == (ssize_t)block;
+    }
+
+private:
+    int fd_;
+    unsigned char *data_;
+};
+
+class PrwEngine {
+public:
+    static constexpr const char *NAME = "prw";
+    static constexpr bool POSITIONED = true;
+
+    PrwEngine(int fd, const IoTask &, AlignedBuffer &buffer, const Config &)
+        : fd_(fd), data_(buffer.data()) {}
+    void source(unsigned char *data) { data_ = data; }
+    bool write(size_t offset, size_t block, JobStats &) {
+        return pwrite(fd_, data_, block, offset) == (ssize_t)block;
+    }
+    bool read(size_t offset, size_t block, JobStats &) {
+        return pread(fd_, data_, block, offset) == (ssize_t)block;
+    }
+
+private:
+    int fd_;
+    unsigned char *data_;
+};
+
+#ifdef HAVE_PREADV2
+class PrwvEngine {
+public:
+    static constexpr const char *NAME = "prwv";
+    static constexpr bool POSITIONED = true;
+
+    PrwvEngine(int fd, const IoTask &, AlignedBuffer &buffer,
+        const Config &config)
+        : fd_(fd), flags_(config.rwFlags), block_(block_size(config)),
+          iov_(make_iovecs(buffer, config)), single_{{buffer.data(), 0}},
+          base_(buffer.data()) {}
+    // The segments move with the data, keeping their split
+    void source(unsigned char *data) {
+        for (auto &segment : iov_) {
+            segment.iov_base = data + (static_cast<unsigned char *>(
+                segment.iov_base) - base_);
+        }
+        single_[0].iov_base = data;
+        base_ = data;
+    }
+    bool write(size_t offset, size_t block, JobStats &stats) {
+        return prwv_transfer(fd_, segments(block), block, offset, flags_, true,
+            stats);
+    }
+    bool read(size_t offset, size_t block, JobStats &stats) {
+        return prwv_transfer(fd_, segments(block), block, offset, flags_, false,
+            stats);
+    }
+
+private:
+    // The iovecs split the configured block, a replayed operation of
+    // another length goes as one segment
+    const vector<iovec> &segments(size_t block) {
+        if (block == block_) {
+            return iov_;
+        }
+        single_[0].iov_len = block;
+        return single_;
+    }
+
+    int fd_;
+    int flags_;
+    size_t block_;
+    vector<iovec> iov_;
+    vector<iovec> single_;
+    unsigned char *base_;
+};
+#endif
+
+// Wait for the intended start of the next operation of a paced job; the
+// schedule starts with the job's first operation and runs on across its
+// tasks. A late job issues at once without skipping operations.
+inline uint64_t pace(JobStats &stats) {
+    if (stats.intendedNs == 0) {
+        stats.intendedNs = now_ns();
+    }
+    return wait_until(stats.intendedNs);
+}
+
+// Paced loops issue every operation at its intended time, open loop, and
+// measure latency from there: an operation that had to wait for the previous
+// one counts the wait (coordinated omission).
+template <class Engine, Pattern P, bool Verify, bool Commits, bool Record,
+    bool Paced>
+void write_loop(Engine &engine, int fd, const IoTask &task,
+    AlignedBuffer &buffer, const Config &config, JobStats &stats) {
+    static const string write_at = string(Engine::NAME) + "_write_file/write";
+    static const string commit_at = string(Engine::NAME) + "_write_file/commit";
+    OffsetGenerator offsets(config, task);
+    size_t count = offsets.count();
+    size_t block = block_size(config);
+    Committer commits(fd, config.sync, stats, task.slot);
+    DataCursor source(buffer, block, config.data, task.seed);
+    if constexpr (Record) {
+        // the writes and at most a commit after each
+        stats.trace.reserve(stats.trace.size() + count * (Commits ? 2 : 1) + 1);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = offsets.next_as<P>();
+        unsigned char *data = source.next(block, stats);
+        engine.source(data);
+        if constexpr (Verify) {
+            stamp_block(data, block, offset, i, task.seed, stats);
+        }
+        uint64_t start = Paced ? pace(stats) : now_ns();
+        if (!engine.write(offset, block, stats)) {
+            perror("write");
+            throw string_view(write_at);
+        }
+        uint64_t end = now_ns();
+        uint64_t latency = end - start;
+        if constexpr (Paced) {
+            stats.service.record(latency);
+            stats.latency.record(end - stats.intendedNs);
+            stats.intendedNs += stats.intervalNs;
+        }
+        else {
+            stats.latency.record(latency);
+        }
+        stats.progress(block);
+        if constexpr (Record) {
+            stats.trace.push_back({start, offset, static_cast<uint32_t>(block),
+                task.slot, TraceOp::Write, 0});
+        }
+        if constexpr (Commits) {
+            if (!commits.written(offset, block, latency)) {
+                throw string_view(commit_at);
+            }
+        }
+    }
+    if (!commits.finish()) {
+        throw string_view(commit_at);
+    }
+}
+
+template <class Engine, Pattern P, bool Verify, bool Record, bool Paced>
+uint8_t read_loop(Engine &engine, const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+    static const string read_at = string(Engine::NAME) + "_read_file/read";
+    uint8_t sink = 0;
+    OffsetGenerator offsets(config, task);
+    size_t count = offsets.count();
+    size_t block = block_size(config);
+    if constexpr (Record) {
+        stats.trace.reserve(stats.trace.size() + count);
+    }
+    // a sequential pass writes every block once, in order
+    vector<size_t> sequences;
+    if constexpr (Verify && P != Pattern::Sequential) {
+        sequences = write_sequences(offsets, task, block, stats);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = offsets.next_as<P>();
+        uint64_t start = Paced ? pace(stats) : now_ns();
+        if (!engine.read(offset, block, stats)) {
+            perror("read");
+            throw string_view(read_at);
+        }
+        uint64_t end = now_ns();
+        if constexpr (Paced) {
+            stats.service.record(end - start);
+            stats.latency.record(end - stats.intendedNs);
+            stats.intendedNs += stats.intervalNs;
+        }
+        else {
+            stats.latency.record(end - start);
+        }
+        stats.progress(block);
+        if constexpr (Record) {
+            stats.trace.push_back({start, offset, static_cast<uint32_t>(block),
+                task.slot, TraceOp::Read, 0});
+        }
+        if constexpr (Verify) {
+            verify_block(buffer.data(), block, offset,
+                P == Pattern::Sequential ? i :
+                sequences[(offset - task.offset) / block], task.seed, stats);
+        }
+        sink ^= buffer[0];
+    }
+    return sink;
+}
+
+// Pattern of an engine's loop: the configured one, or sequential for an
+// engine that moves through the file on its own
+template <class Engine>
+Pattern engine_pattern(const Config &config) {
+    return Engine::POSITIONED ? config.pattern : Pattern::Sequential;
+}
+
+template <class Engine>
+void fd_write_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+    // ==== Write ====
+    int fd = open_file(task.filename, write_open_flags(config), config.directIO);
+    if (fd < 0) {
+        perror("open write");
+        throw string_view("fd_write_file/open");
+    }
+    try {
+        Engine engine(fd, task, buffer, config);
+        with_pattern(engine_pattern<Engine>(config), [&](auto pattern) {
+            with_flag(config.verify, [&](auto verify) {
+                with_flag(Committer::per_write(config.sync), [&](auto commits) {
+                    with_flag(stats.recording, [&](auto record) {
+                        with_flag(stats.intervalNs != 0, [&](auto paced) {
+                            write_loop<Engine, decltype(pattern)::value,
+                                decltype(verify)::value, decltype(commits)::value,
+                                decltype(record)::value, decltype(paced)::value>(
+                                engine, fd, task, buffer, config, stats);
+                        });
+                    });
+                });
+            });
+        });
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
+
+template <class Engine>
+uint8_t fd_read_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+    // ==== Read ====
+    int fd = open_file(task.filename, O_RDONLY, config.directIO);
+    if (fd < 0) {
+        perror("open read");
+        throw string_view("fd_read_file/open");
+    }
+    uint8_t sink = 0;
+    try {
+        Engine engine(fd, task, buffer, config);
+        sink = with_pattern(engine_pattern<Engine>(config), [&](auto pattern) {
+            return with_flag(config.verify, [&](auto verify) {
+                return with_flag(stats.recording, [&](auto record) {
+                    return with_flag(stats.intervalNs != 0, [&](auto paced) {
+                        return read_loop<Engine, decltype(pattern)::value,
+                            decltype(verify)::value, decltype(record)::value,
+                            decltype(paced)::value>(engine, task, buffer, config,
+                            stats);
+                    });
+                });
+            });
+        });
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return sink;
+}
+
+// One pass of a mixed phase over the task region: every operation is a write
+// with the probability of the task and a read otherwise. The reads go to the
+// first block of the buffer, the writes come from the -data pool.
+template <class Engine, Pattern P, bool Commits>
+uint8_t mixed_loop(Engine &engine, int fd, const IoTask &task,
+    AlignedBuffer &buffer, const Config &config, JobStats &stats) {
+    static const string write_at = string(Engine::NAME) + "_mix_file/write";
+    static const string read_at = string(Engine::NAME) + "_mix_file/read";
+    static const string commit_at = string(Engine::NAME) + "_mix_file/commit";
+    uint8_t sink = 0;
+    OffsetGenerator offsets(config, task);
+    size_t count = offsets.count();
+    size_t block = block_size(config);
+    Committer commits(fd, config.sync, stats, task.slot);
+    DataCursor source(buffer, block, config.data, task.seed);
+    for (size_t i = 0; i < count; ++i) {
+        bool write = offsets.chance(task.writeShare);
+        size_t offset = offsets.next_as<P>();
+        engine.source(write ? source.next(block, stats) : buffer.data());
+        uint64_t start = now_ns();
+        if (!(write ? engine.write(offset, block, stats) :
+            engine.read(offset, block, stats))) {
+            perror(write ? "write" : "read");
+            throw string_view(write ? write_at : read_at);
+        }
+        uint64_t latency = now_ns() - start;
+        stats.progress(block);
+        if (!write) {
+            stats.latency.record(latency);
+            sink ^= buffer[0];
+            continue;
+        }
+        stats.writeLatency.record(latency);
+        stats.writtenBytes += block;
+        if constexpr (Commits) {
+            if (!commits.written(offset, block, latency)) {
+                throw string_view(commit_at);
+            }
+        }
+    }
+    if (!commits.finish()) {
+        throw string_view(commit_at);
+    }
+    return sink;
+}
+
+template <class Engine>
+uint8_t fd_mix_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+    // ==== Read and write ====
+    int fd = open_file(task.filename, (write_open_flags(config) & ~O_WRONLY) |
+        O_RDWR, config.directIO);
+    if (fd < 0) {
+        perror("open mix");
+        throw string_view("fd_mix_file/open");
+    }
+    uint8_t sink = 0;
+    try {
+        Engine engine(fd, task, buffer, config);
+        sink = with_pattern(engine_pattern<Engine>(config), [&](auto pattern) {
+            return with_flag(Committer::per_write(config.sync), [&](auto commits) {
+                return mixed_loop<Engine, decltype(pattern)::value,
+                    decltype(commits)::value>(engine, fd, task, buffer, config,
+                    stats);
+            });
+        });
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return sink;
+}
+
+// Operations of one job, the streams are spread over the jobs by slot
+struct ReplayJob {
+    vector<TraceRecord> records;
+    vector<int> fds;          // by slot, -1 for the slots of other jobs
+};
+
+// Replay the records of a job through an engine, at the trace timing or
+// back to back. Timestamps count from `origin`, the start of the first job.
+template <class Engine>
+uint8_t replay_records(const ReplayJob &job, AlignedBuffer &buffer,
+    const Config &config, atomic<uint64_t> &origin, JobStats &stats) {
+    vector<unique_ptr<Engine>> engines(job.fds.size());
+    for (size_t slot = 0; slot < job.fds.size(); ++slot) {
+        if (job.fds[slot] >= 0) {
+            engines[slot] = make_unique<Engine>(job.fds[slot], IoTask(), buffer,
+                config);
+        }
+    }
+    DataCursor source(buffer, max(config.bufferSize, block_size(config)),
+        config.data, config.seed);
+    // the first job to get here sets the origin
+    uint64_t unset = 0;
+    origin.compare_exchange_strong(unset, now_ns());
+    uint64_t start = origin.load();
+    for (const auto &record : job.records) {
+        if (config.replayOriginal) {
+            uint64_t due = start + record.timestampNs;
+            stats.lagNs = max(stats.lagNs, wait_until(due) - due);
+        }
+        int fd = job.fds[record.slot];
+        uint64_t begin = now_ns();
+        bool ok = true;
+        switch (record.op) {
+        case TraceOp::Read:
+            engines[record.slot]->source(buffer.data());
+            ok = engines[record.slot]->read(record.offset, record.length, stats);
+            break;
+        case TraceOp::Write:
+            engines[record.slot]->source(source.next(record.length, stats));
+            ok = engines[record.slot]->write(record.offset, record.length, stats);
+            break;
+        case TraceOp::Fsync:
+            break;
+        }
+        if (!ok) {
+            perror(record.op == TraceOp::Read ? "read" : "write");
+            throw string_view("replay_records/transfer");
+        }
+        if (record.op != TraceOp::Fsync) {
+            stats.latency.record(now_ns() - begin);
+            stats.progress(record.length);
+        }
+        if (record.op == TraceOp::Fsync || (record.flags & TRACE_SYNC)) {
+            uint64_t commit_start = now_ns();
+            if (fdatasync(fd) != 0) {
+                perror("fdatasync");
+                throw string_view("replay_records/fdatasync");
+            }
+            stats.commit.record(now_ns() - commit_start);
+        }
+    }
+    return buffer[0];
+}
+
+#ifdef HAVE_IO_URING
+// Minimal io_uring ring on top of the raw system calls, so the tool does not
+// depend on liburing
+class IoUring {
+public:
+    IoUring(unsigned entries, bool sqpoll) : sqpoll_(sqpoll) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        if (sqpoll) {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = 2000; // ms
+        }
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd_ < 0) {
+            perror("io_uring_setup");
+            throw string_view("IoUring/setup");
+        }
+        sq_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_len_ = cq_len_ = max(sq_len_, cq_len_);
+        }
+        sq_ptr_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single_mmap ? sq_ptr_ : mmap(nullptr, cq_len_,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+            IORING_OFF_CQ_RING);
+        sqes_len_ = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes == MAP_FAILED) {
+            perror("mmap io_uring");
+            close(ring_fd_);
+            throw string_view("IoUring/mmap");
+        }
+        auto *sq = static_cast<uint8_t *>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_flags_ = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+        auto *cq = static_cast<uint8_t *>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        // the kernel never reorders the SQ array, fill it once
+        for (unsigned i = 0; i < sq_entries_; ++i) {
+            sq_array_[i] = i;
+        }
+        sq_local_tail_ = *sq_tail_;
+    }
+
+    ~IoUring() {
+        munmap(sqes_, sqes_len_);
+        if (cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_len_);
+        }
+        munmap(sq_ptr_, sq_len_);
+        close(ring_fd_);
+    }
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    // Register a buffer for IORING_OP_READ_FIXED/WRITE_FIXED (index 0)
+    void register_buffer(void *data, size_t size) {
+        iovec iov{data, size};
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+            &iov, 1) < 0) {
+            perror("io_uring_register buffers");
+            throw string_view("IoUring/register_buffer");
+        }
+    }
+
+    // Register a file for IOSQE_FIXED_FILE (index 0)
+    void register_file(int fd) {
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_FILES,
+            &fd, 1) < 0) {
+            perror("io_uring_register files");
+            throw string_view("IoUring/register_file");
+        }
+    }
+
+    // Next free submission entry, nullptr if the queue is full
+    io_uring_sqe *get_sqe() {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_local_tail_ - head >= sq_entries_) {
+            return nullptr;
+        }
+        io_uring_sqe *sqe = &sqes_[sq_local_tail_++ & sq_mask_];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Publish all prepared entries in one batch and wait for at least
+    // `wait_nr` completions
+    void submit(unsigned wait_nr) {
+        unsigned to_submit = sq_local_tail_ - *sq_tail_;
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if (sqpoll_) {
+            // the kernel thread picks the entries up by itself unless idle
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+            to_submit = 0;
+            if (!flags) {
+                return;
+            }
+        }
+        else if (!to_submit && !wait_nr) {
+            return;
+        }
+        if (syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_nr, flags,
+            nullptr, 0) < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            throw string_view("IoUring/enter");
+        }
+    }
+
+    // Call `f(cqe)` for every available completion, return their count
+    template <typename F>
+    unsigned reap(F f) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; ++head, ++count) {
+            f(cqes_[head & cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+private:
+    int ring_fd_ = -1;
+    bool sqpoll_;
+    void *sq_ptr_ = nullptr;
+    void *cq_ptr_ = nullptr;
+    size_t sq_len_ = 0;
+    size_t cq_len_ = 0;
+    size_t sqes_len_ = 0;
+    unsigned *sq_head_, *sq_tail_, *sq_flags_, *sq_array_;
+    unsigned sq_mask_, sq_entries_, sq_local_tail_;
+    io_uring_sqe *sqes_;
+    unsigned *cq_head_, *cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe *cqes_;
+};
+
+// Keep up to `queueDepth` requests in flight over the task region, each a
+// write with the probability `write_share`: 1 in the write phase, 0 in the
+// read phase and the -mix ratio in between. The reads share the first block
+// of the (registered) buffer and their data is discarded; with random data
+// every write in flight has a window of the data pool of its own,
+// data_pool_size() keeps enough of them.
+unsigned char uring_transfer(int fd, AlignedBuffer &buffer,
+    const IoTask &task, const Config &config, JobStats &stats,
+    double write_share) {
+    IoUring ring(config.queueDepth, config.uringSqpoll);
+    int sqe_fd = fd;
+    uint8_t sqe_flags = 0;
+    if (config.uringFixed) {
+        ring.register_buffer(buffer.data(), buffer.capacity());
+        ring.register_file(fd);
+        sqe_fd = 0;
+        sqe_flags = IOSQE_FIXED_FILE;
+    }
+    auto opcode = [&](bool write) -> uint8_t {
+        return write ?
+            (config.uringFixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE) :
+            (config.uringFixed ? IORING_OP_READ_FIXED : IORING_OP_READ);
+    };
+    bool mixed = task.writeShare > 0;  // writes apart from the reads
+
+    OffsetGenerator offsets(config, task);
+    size_t ops = offsets.count();
+    size_t block = block_size(config);
+    size_t submitted = 0;
+    size_t completed = 0;
+    unsigned inflight = 0;
+    bool failed = false;
+    DataCursor source(buffer, block, config.data, task.seed);
+    bool rotate = write_share > 0 && source.windows() >= config.queueDepth;
+    // requests in flight by their user data
+    struct Request {
+        uint64_t started;  // latency is counted from the preparation
+        size_t window;
+        bool write;
+    };
+    vector<Request> requests(config.queueDepth);
+    vector<size_t> free_requests;
+    for (size_t r = config.queueDepth; r-- > 0; ) {
+        free_requests.push_back(r);
+    }
+    vector<size_t> free_windows;
+    for (size_t w = rotate ? source.windows() : 0; w-- > 0; ) {
+        free_windows.push_back(w);
+    }
+    while (completed < ops) {
+        while (inflight < config.queueDepth && submitted < ops) {
+            io_uring_sqe *sqe = ring.get_sqe();
+            if (!sqe) {
+                break;
+            }
+            size_t r = free_requests.back();
+            free_requests.pop_back();
+            Request &request = requests[r];
+            request.write = write_share >= 1 ||
+                (write_share > 0 && offsets.chance(write_share));
+            unsigned char *data = buffer.data();
+            if (request.write && rotate) {
+                request.window = free_windows.back();
+                free_windows.pop_back();
+                data = source.at(request.window, block, stats);
+            }
+            else if (request.write) {
+                data = source.next(block, stats);
+            }
+            sqe->opcode = opcode(request.write);
+            sqe->flags = sqe_flags;
+            sqe->fd = sqe_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(data);
+            sqe->len = static_cast<uint32_t>(block);
+            sqe->off = offsets.next();
+            sqe->buf_index = 0;
+            sqe->user_data = r;
+            request.started = now_ns();
+            ++submitted;
+            ++inflight;
+        }
+        ring.submit(1);
+        uint64_t reaped = 0;
+        unsigned done = ring.reap([&](const io_uring_cqe &cqe) {
+            if (!reaped) {
+                reaped = now_ns();
+            }
+            const Request &request = requests[cqe.user_data];
+            if (mixed && request.write) {
+                stats.writeLatency.record(reaped - request.started);
+                stats.writtenBytes += cqe.res > 0 ? cqe.res : 0;
+            }
+            else {
+                stats.latency.record(reaped - request.started);
+            }
+            if (request.write && rotate) {
+                free_windows.push_back(request.window);
+            }
+            free_requests.push_back(cqe.user_data);
+            if (cqe.res > 0) {
+                stats.progress(cqe.res);
+            }
+            if (cqe.res != static_cast<int>(block)) {
+                if (cqe.res < 0) {
+                    errno = -cqe.res;
+                    perror(request.write ? "io_uring write" : "io_uring read");
+                }
+                failed = true;
+            }
+        });
+        inflight -= done;
+        completed += done;
+        if (failed) {
+            throw string_view(write_share >= 1 ? "uring_write_file/write" :
+                write_share > 0 ? "uring_mix_file/transfer" :
+                "uring_read_file/read");
+        }
+    }
+    return buffer[0];
+}
+#endif
+
+void uring_write_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+#ifdef HAVE_IO_URING
+    int fd = open_file(task.filename, O_CREAT | O_WRONLY, config.directIO);
+    if (fd < 0) {
+        perror("open write");
+        throw string_view("uring_write_file/open");
+    }
+    try {
+        uring_transfer(fd, buffer, task, config, stats, 1);
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    fsync(fd);
+    close(fd);
+#else
+    (void)task; (void)buffer; (void)config; (void)stats;
+    throw string_view("uring_write_file/unsupported");
+#endif
+}
+
+unsigned char uring_read_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+#ifdef HAVE_IO_URING
+    int fd = open_file(task.filename, O_RDONLY, config.directIO);
+    if (fd < 0) {
+        perror("open read");
+        throw string_view("uring_read_file/open");
+    }
+    unsigned char sink;
+    try {
+        sink = uring_transfer(fd, buffer, task, config, stats, 0);
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return sink;
+#else
+    (void)task; (void)buffer; (void)config; (void)stats;
+    throw string_view("uring_read_file/unsupported");
+#endif
+}
+
+unsigned char uring_mix_file(const IoTask &task, AlignedBuffer &buffer,
+    const Config &config, JobStats &stats) {
+#ifdef HAVE_IO_URING
+    int fd = open_file(task.filename, (write_open_flags(config) & ~O_WRONLY) |
+        O_RDWR, config.directIO);
+    if (fd < 0) {
+        perror("open mix");
+        throw string_view("uring_mix_file/open");
+    }
+    unsigned char sink;
+    try {
+        sink = uring_transfer(fd, buffer, task, config, stats,
+            task.writeShare);
+        Committer commits(fd, config.sync, stats, task.slot);
+        if (!commits.finish()) {
+            throw string_view("uring_mix_file/commit");
+        }
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return sink;
+#else
+    (void)task; (void)buffer; (void)config; (void)stats;
+    throw string_view("uring_mix_file/unsupported");
+#endif
+}
+
+// Timing of one phase (all writes or all reads of a size step)
+struct PhaseResult {
+    double seconds = 0;            // from the common start to the last job
+    vector<double> jobSeconds;     // from the common start to each job's end
+    vector<size_t> jobBytes;
+    LatencyHistogram latency;      // all jobs merged
+    vector<LatencyHistogram> jobLatency;
+    vector<double> trialSpeeds;    // MB/s of every trial of the step
+    vector<double> trialP99;       // us, latency of every trial of the step
+    vector<pair<double, uint64_t>> timeline; // (seconds, bytes) of -sample
+    bool timelineWrapped = false;  // the ring dropped the first samples
+    LatencyHistogram commit;
+    uint64_t verifyNs = 0;         // CPU time of all jobs
+    uint64_t verifiedBlocks = 0;
+    uint64_t corruptBlocks = 0;
+    ThreadUsage usage;             // all jobs
+    PerfValues perf{};
+    IoCounters io;                 // process and device, set by run_step
+    size_t trials = 1;             // usage, perf and io sum this many trials
+    vector<TraceRecord> trace;     // -record, all jobs
+    uint64_t lagNs = 0;
+    bool mixed = false;            // replay: reads and writes in one phase
+    LatencyHistogram service;      // -rate: the latency counts from the
+                                   // intended start, this the calls alone
+    LatencyHistogram writeLatency; // mixed phase, latency has the reads
+    uint64_t writtenBytes = 0;
+    uint64_t nowaitAgain = 0;
+    uint64_t nowaitShort = 0;
+    uint8_t sink = 0;
+};
+
+// Split the files of a size step between the jobs. Every job writes its own
+// files, or with a shared file a disjoint region of each file.
+vector<vector<IoTask>> make_tasks(const Config &config, const string &mount_path,
+    size_t size_bytes, vector<string> &filenames) {
+    vector<vector<IoTask>> tasks(config.jobs);
+    size_t region = size_bytes;
+    if (config.sharedFile) {
+        // keep the regions aligned to whole buffers and blocks
+        size_t unit = max(config.bufferSize, block_size(config));
+        region = size_bytes / config.jobs / unit * unit;
+        if (region == 0) {
+            throw invalid_argument("file size is too small to split between "
+                "the jobs");
+        }
+    }
+    map<size_t, double> zetas;  // Zipf: by the blocks of a region
+    for (int i = 0; i < config.iterations; ++i) {
+        for (int j = 0; j < config.jobs; ++j) {
+            IoTask task;
+            task.filename = mount_path + "/testfile_" + to_string(i);
+            task.slot = config.sharedFile ? i : i * config.jobs + j;
+            task.seed = config.seed + i * config.jobs + j;
+            if (config.sharedFile) {
+                task.offset = j * region;
+                task.size = j + 1 < config.jobs ? region : size_bytes - task.offset;
+                task.sharedFile = config.jobs > 1;
+            }
+            else {
+                task.size = size_bytes;
+                if (config.jobs > 1) {
+                    task.filename += "_" + to_string(j);
+                }
+            }
+            task.filename += ".bin";
+            if (config.pattern == Pattern::Zipf) {
+                size_t blocks = task.size / block_size(config);
+                auto zeta = zetas.find(blocks);
+                if (zeta == zetas.end()) {
+                    zeta = zetas.emplace(blocks,
+                        zipf_zeta(blocks, config.zipfTheta)).first;
+                }
+                task.zipfZeta = zeta->second;
+            }
+            if (j == 0 || !config.sharedFile) {
+                filenames.push_back(task.filename);
+            }
+            tasks[j].push_back(task);
+        }
+    }
+    return tasks;
+}
+
+// Lay a test file out by -layout before the write phase; the engines then
+// write into it
+void prepare_file(const string &filename, size_t size_bytes,
+    const Config &config) {
+    Layout layout = config.layout;
+    // random writes may not reach the end of the file
+    if (layout == Layout::Fresh && ((config.sharedFile && config.jobs > 1) ||
+        config.pattern != Pattern::Sequential)) {
+        layout = Layout::Sparse;
+    }
+    int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open layout");
+        throw string_view("prepare_file/open");
+    }
+    int err = 0;
+    switch (layout) {
+    case Layout::Fresh:
+    case Layout::Append:
+        break;
+    case Layout::Sparse:
+        err = ftruncate(fd, size_bytes);
+        break;
+    case Layout::Fallocate:
+#ifdef __APPLE__
+        {
+            fstore_t store = {F_ALLOCATEALL, F_PEOFPOSMODE, 0,
+                static_cast<off_t>(size_bytes), 0};
+            err = fcntl(fd, F_PREALLOCATE, &store) == -1 ||
+                ftruncate(fd, size_bytes) != 0;
+        }
+#else
+        // posix_fallocate returns the error instead of setting errno
+        errno = posix_fallocate(fd, 0, size_bytes);
+        err = errno;
+#endif
+        break;
+    case Layout::Overwrite: {
+        // allocate and write every block, then drop it from the cache
+        vector<char> zeros(1 << 20);
+        for (size_t done = 0; done < size_bytes && !err; ) {
+            size_t chunk = min(zeros.size(), size_bytes - done);
+            ssize_t n = write(fd, zeros.data(), chunk);
+            err = n <= 0;
+            done += n > 0 ? n : 0;
+        }
+        if (!err) {
+            err = fsync(fd);
+        }
+        break;
+    }
+    }
+    if (err) {
+        perror("layout");
+        close(fd);
+        throw string_view("prepare_file/layout");
+    }
+    close(fd);
+    if (layout == Layout::Overwrite) {
+        evict_file_cache(filename);
+    }
+}
+
+// Number of extents of a file, -1 where FIEMAP is not supported
+long file_extents(const string &filename) {
+#ifdef FS_IOC_FIEMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    // no extent array: the kernel only counts them
+    fiemap map = {};
+    map.fm_length = FIEMAP_MAX_OFFSET;
+    map.fm_flags = FIEMAP_FLAG_SYNC;
+    long extents = ioctl(fd, FS_IOC_FIEMAP, &map) == 0 ?
+        static_cast<long>(map.fm_mapped_extents) : -1;
+    close(fd);
+    return extents;
+#else
+    (void)filename;
+    return -1;
+#endif
+}
+
+// ---- Engine registry ----
+// The write and read functions of every -f function. A new engine is one
+// class for fd_write_file/fd_read_file (or a pair of functions) and a line
+// here.
+using WriteFile = void (*)(const IoTask &, AlignedBuffer &, const Config &,
+    JobStats &);
+using ReadFile = uint8_t (*)(const IoTask &, AlignedBuffer &, const Config &,
+    JobStats &);
+using ReplayFile = uint8_t (*)(const ReplayJob &, AlignedBuffer &,
+    const Config &, atomic<uint64_t> &, JobStats &);
+
+struct EngineEntry {
+    Func function;
+    WriteFile write;
+    ReadFile read;
+    ReplayFile replay;  // nullptr - the engine cannot replay traces
+    ReadFile mix;       // nullptr - no -mix phases
+    bool records;       // -record captures its operations
+};
+
+const EngineEntry ENGINES[] = {
+    {Func::ReadWrite, fd_write_file<RwEngine>, fd_read_file<RwEngine>, nullptr,
+        fd_mix_file<RwEngine>, true},
+    {Func::PReadWrite, fd_write_file<PrwEngine>, fd_read_file<PrwEngine>,
+        replay_records<PrwEngine>, fd_mix_file<PrwEngine>, true},
+    {Func::FStream, fs_write_file, fs_read_file, nullptr, nullptr, false},
+    {Func::MMap, mm_write_file, mm_read_file, nullptr, nullptr, false},
+    {Func::Uring, uring_write_file, uring_read_file, nullptr, uring_mix_file,
+        false},
+#ifdef HAVE_PREADV2
+    {Func::PReadWriteV, fd_write_file<PrwvEngine>, fd_read_file<PrwvEngine>,
+        replay_records<PrwvEngine>, fd_mix_file<PrwvEngine>, true},
+#else
+    {Func::PReadWriteV, prwv_write_file, prwv_read_file, nullptr, nullptr,
+        false},
+#endif
+};
+
+const EngineEntry &engine_for(Func function) {
+    for (const auto &engine : ENGINES) {
+        if (engine.function == function) {
+            return engine;
+        }
+    }
+    throw invalid_argument("no engine for the function");
+}
+
+// Run the tasks of every job in a thread of its own, starting them together.
+// With repeat the jobs keep making passes over their tasks until every job
+// has completed one, so that they contend for the whole phase.
+template <class Op>
+PhaseResult run_phase(const vector<vector<IoTask>> &tasks, const Config &config,
+    BufferArena &arena, bool write_op, const Op &op, bool repeat = false) {
+    size_t jobs = tasks.size();
+    PhaseResult result;
+    result.jobSeconds.resize(jobs);
+    result.jobBytes.resize(jobs);
+    atomic<size_t> passed{0};
+    vector<uint8_t> sinks(jobs);
+    vector<JobStats> stats(jobs);
+    vector<exception_ptr> errors(jobs);
+    for (auto &job : stats) {
+        // -record: the write and read phases, not the mixed and rated ones
+        job.recording = !config.recordPath.empty() && !repeat &&
+            config.paceIops == 0;
+        job.intervalNs = config.paceIops > 0 ? static_cast<uint64_t>(1e9 *
+            jobs / config.paceIops) : 0;
+    }
+    atomic<size_t> ready{0};
+    atomic<size_t> finished{0};
+    atomic<bool> go{false};
+    time_point<steady_clock> start;
+
+    auto worker = [&](size_t j) {
+        unique_ptr<AlignedBuffer> buffer;
+        try {
+            if (!config.cpus.empty()) {
+                pin_thread({config.cpus[j % config.cpus.size()]});
+            }
+            buffer = arena.slot(j, max(config.bufferSize, block_size(config)),
+                write_op ? data_pool_size(config) : 0);
+            if (write_op) {
+                fill_data(*buffer, config.data, config.seed + j);
+            }
+            else {
+                memset(buffer->data(), 0, buffer->size());
+            }
+        }
+        catch (...) {
+            errors[j] = current_exception();
+        }
+        PerfCounters perf;
+        ready.fetch_add(1);
+        while (!go.load(memory_order_acquire)) {
+            this_thread::yield();
+        }
+        if (errors[j]) {
+            return;
+        }
+        ThreadUsage usage = thread_usage();
+        perf.start();
+        try {
+            bool first = true;
+            do {
+                for (const auto &task : tasks[j]) {
+                    sinks[j] ^= op(task, *buffer, stats[j]);
+                    result.jobBytes[j] += task.size;
+                }
+                if (first) {
+                    passed.fetch_add(1);
+                    first = false;
+                }
+            } while (repeat && passed.load() < jobs);
+        }
+        catch (...) {
+            errors[j] = current_exception();
+        }
+        duration<double> elapsed = steady_clock::now() - start;
+        result.jobSeconds[j] = elapsed.count();
+        stats[j].perf = perf.stop();
+        stats[j].usage = thread_usage() - usage;
+        finished.fetch_add(1);
+    };
+
+    vector<thread> threads;
+    threads.reserve(jobs);
+    for (size_t j = 0; j < jobs; ++j) {
+        threads.emplace_back(worker, j);
+    }
+    while (ready.load() < jobs) {
+        this_thread::yield();
+    }
+    start = steady_clock::now();
+    go.store(true, memory_order_release);
+    // the sampler only reads the progress counters of the jobs
+    thread sampler;
+    if (config.sampleMs > 0) {
+        sampler = thread([&] {
+            SampleRing ring(SAMPLE_CAPACITY);
+            auto interval = milliseconds(config.sampleMs);
+            auto next = start + interval;
+            bool done = false;
+            while (!done) {
+                this_thread::sleep_until(next);
+                done = finished.load() == jobs;
+                uint64_t bytes = 0;
+                for (const auto &job : stats) {
+                    bytes += job.bytesDone.load(memory_order_relaxed);
+                }
+                duration<double> elapsed = steady_clock::now() - start;
+                ring.push(elapsed.count(), bytes);
+                next += interval;
+            }
+            result.timeline = ring.ordered();
+            result.timelineWrapped = ring.wrapped();
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    if (sampler.joinable()) {
+        sampler.join();
+    }
+    for (size_t j = 0; j < jobs; ++j) {
+        if (errors[j]) {
+            rethrow_exception(errors[j]);
+        }
+        result.sink ^= sinks[j];
+        result.latency.merge(stats[j].latency);
+        result.jobLatency.push_back(stats[j].latency);
+        result.verifyNs += stats[j].verifyNs;
+        result.verifiedBlocks += stats[j].verifiedBlocks;
+        result.corruptBlocks += stats[j].corruptBlocks;
+        result.usage += stats[j].usage;
+        add_perf(result.perf, stats[j].perf, j == 0);
+        result.commit.merge(stats[j].commit);
+        result.nowaitAgain += stats[j].nowaitAgain;
+        result.nowaitShort += stats[j].nowaitShort;
+        result.trace.insert(result.trace.end(), stats[j].trace.begin(),
+            stats[j].trace.end());
+        result.lagNs = max(result.lagNs, stats[j].lagNs);
+        result.service.merge(stats[j].service);
+        result.writeLatency.merge(stats[j].writeLatency);
+        result.writtenBytes += stats[j].writtenBytes;
+        if (!stats[j].firstError.empty()) {
+            cerr << "Job " << j << ": " << stats[j].corruptBlocks <<
+                " corrupt blocks, first: " << stats[j].firstError << '\n';
+        }
+        result.seconds = max(result.seconds, result.jobSeconds[j]);
+    }
+    // the last sample is taken after the jobs have finished
+    if (!result.timeline.empty()) {
+        result.timeline.back().first = min(result.timeline.back().first,
+            result.seconds);
+    }
+    return result;
+}
+
+// Print the throughput of every job and the spread between the slowest and
+// the fastest one relative to their mean
+void print_job_speeds(const char *phase, const PhaseResult &result) {
+    vector<double> speeds;
+    for (size_t j = 0; j < result.jobBytes.size(); ++j) {
+        speeds.push_back(result.jobBytes[j] / double(1 << 20) /
+            result.jobSeconds[j]);
+    }
+    auto [min_it, max_it] = minmax_element(speeds.begin(), speeds.end());
+    double mean = accumulate(speeds.begin(), speeds.end(), 0.0) / speeds.size();
+    cout << "  " << phase << " per job, MB/s:";
+    for (double speed : speeds) {
+        cout << ' ' << speed;
+    }
+    cout << " | spread: " << (*max_it - *min_it) / mean * 100 << "%\n";
+}
+
+// Throughput between the samples of a phase: (seconds at the end of the
+// interval, MB/s). Once the ring has wrapped, the oldest sample left only
+// starts the first interval, the one before it is gone.
+vector<pair<double, double>> timeline_speeds(const PhaseResult &phase) {
+    vector<pair<double, double>> speeds;
+    double last_seconds = 0;
+    uint64_t last_bytes = 0;
+    bool first = phase.timelineWrapped;
+    for (const auto &[seconds, bytes] : phase.timeline) {
+        if (seconds > last_seconds && !first) {
+            speeds.emplace_back(seconds, (bytes - last_bytes) /
+                double(1 << 20) / (seconds - last_seconds));
+        }
+        first = false;
+        last_seconds = seconds;
+        last_bytes = bytes;
+    }
+    return speeds;
+}
+
+void print_timeline(const char *phase, const PhaseResult &result, int sample_ms) {
+    cout << "  " << phase << " MB/s every " << sample_ms << " ms:";
+    for (const auto &[seconds, speed] : timeline_speeds(result)) {
+        cout << ' ' << static_cast<long>(speed);
+    }
+    cout << '\n';
+}
+
+// Print the latency percentiles of a phase in microseconds
+void print_latency(const char *phase, const LatencyHistogram &latency) {
+    cout << "  " << phase << " latency, us: p50 " <<
+        latency.percentile(0.5) / 1e3 << " | p99 " <<
+        latency.percentile(0.99) / 1e3 << " | p99.9 " <<
+        latency.percentile(0.999) / 1e3 << " | max " <<
+        latency.maxValue() / 1e3 << '\n';
+}
+
+void cleanup(vector<string>& filenames) {
+    for (const auto &filename : filenames) {
+        unlink(filename.c_str());
+    }
+}
+
+// ---- Copy methods ----
+// Every method copies `size` bytes from `in` to `out`. It returns false if the
+// kernel or the filesystem does not support the method, and throws on other
+// errors.
+
+// Throw the failing call unless errno means "not supported here"
+bool copy_unsupported(const char *call) {
+    if (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+        errno == EOPNOTSUPP || errno == ENOTTY) {
+        return true;
+    }
+    perror(call);
+    throw string_view("copy_file");
+}
+
+bool copy_rw(int in, int out, size_t size, AlignedBuffer &buffer) {
+    for (size_t copied = 0; copied < size; ) {
+        ssize_t n = read(in, buffer.data(), buffer.size());
+        if (n <= 0) {
+            perror("read");
+            throw string_view("copy_rw/read");
+        }
+        if (write(out, buffer.data(), n) != n) {
+            perror("write");
+            throw string_view("copy_rw/write");
+        }
+        copied += n;
+    }
+    return true;
+}
+
+#ifdef __linux__
+bool copy_sendfile(int in, int out, size_t size, AlignedBuffer &buffer) {
+    for (size_t copied = 0; copied < size; ) {
+        ssize_t n = sendfile(out, in, nullptr, min(buffer.size(), size - copied));
+        if (n < 0 && copied == 0 && copy_unsupported("sendfile")) {
+            return false;
+        }
+        if (n <= 0) {
+            throw string_view("copy_sendfile/sendfile");
+        }
+        copied += n;
+    }
+    return true;
+}
+
+bool copy_splice(int in, int out, size_t size, AlignedBuffer &buffer) {
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        perror("pipe");
+        throw string_view("copy_splice/pipe");
+    }
+    // a pipe as large as the buffer, if the limits allow it
+    fcntl(pipefd[1], F_SETPIPE_SZ, static_cast<int>(buffer.size()));
+    auto close_pipe = [&pipefd] {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    };
+    for (size_t copied = 0; copied < size; ) {
+        ssize_t n = splice(in, nullptr, pipefd[1], nullptr,
+            min(buffer.size(), size - copied), SPLICE_F_MOVE);
+        if (n < 0 && copied == 0 && copy_unsupported("splice")) {
+            close_pipe();
+            return false;
+        }
+        if (n <= 0) {
+            close_pipe();
+            throw string_view("copy_splice/splice");
+        }
+        for (ssize_t left = n; left > 0; ) {
+            ssize_t m = splice(pipefd[0], nullptr, out, nullptr, left,
+                SPLICE_F_MOVE);
+            if (m <= 0) {
+                perror("splice");
+                close_pipe();
+                throw string_view("copy_splice/splice");
+            }
+            left -= m;
+        }
+        copied += n;
+    }
+    close_pipe();
+    return true;
+}
+
+bool copy_range(int in, int out, size_t size, AlignedBuffer &) {
+    for (size_t copied = 0; copied < size; ) {
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, size - copied, 0);
+        if (n < 0 && copied == 0 && copy_unsupported("copy_file_range")) {
+            return false;
+        }
+        if (n <= 0) {
+            throw string_view("copy_range/copy_file_range");
+        }
+        copied += n;
+    }
+    return true;
+}
+
+bool copy_reflink(int in, int out, size_t, AlignedBuffer &) {
+    return ioctl(out, FICLONE, in) == 0 || !copy_unsupported("ioctl FICLONE");
+}
+#endif
+
+struct CopyMethod {
+    const char *name;
+    bool (*copy)(int in, int out, size_t size, AlignedBuffer &buffer);
+    bool direct; // the method can use direct I/O
+};
+
+const vector<CopyMethod> &copy_methods() {
+    static const vector<CopyMethod> methods{
+        {"read/write", copy_rw, true},
+#ifdef __linux__
+        {"sendfile", copy_sendfile, false},
+        {"splice", copy_splice, false},
+        {"copy_file_range", copy_range, false},
+        {"reflink", copy_reflink, false},
+#endif
+    };
+    return methods;
+}
+
+// Result of one copy method over all the files of a step
+struct CopyResult {
+    const char *method;
+    bool supported = true;
+    double seconds = 0;
+    double cpuSeconds = 0; // user + system
+};
+
+// CPU time of the calling thread so far, in seconds
+double thread_cpu_seconds() {
+    ThreadUsage usage = thread_usage();
+    return (usage.userNs + usage.systemNs) / 1e9;
+}
+
+// Copy every file with every method. The sources are dropped from the page
+// cache before each method and the copies are flushed before the clock stops.
+vector<CopyResult> run_copies(const Config &config,
+    const vector<string> &filenames, size_t size_bytes, BufferArena &arena) {
+    auto slot = arena.slot(0, config.bufferSize);
+    AlignedBuffer &buffer = *slot;
+    vector<CopyResult> results;
+    for (const auto &method : copy_methods()) {
+        CopyResult result;
+        result.method = method.name;
+        if (config.directIO) {
+            for (const auto &filename : filenames) {
+                evict_file_cache(filename);
+            }
+        }
+        bool direct = config.directIO && method.direct;
+        double cpu_start = thread_cpu_seconds();
+        auto start = steady_clock::now();
+        for (const auto &filename : filenames) {
+            string copy_name = filename + ".copy";
+            int in = open_file(filename, O_RDONLY, direct);
+            int out = open_file(copy_name, O_CREAT | O_WRONLY | O_TRUNC, direct);
+            if (in < 0 || out < 0) {
+                perror("open copy");
+                throw string_view("run_copies/open");
+            }
+            try {
+                result.supported = method.copy(in, out, size_bytes, buffer);
+            }
+            catch (...) {
+                close(in);
+                close(out);
+                unlink(copy_name.c_str());
+                throw;
+            }
+            fsync(out);
+            close(in);
+            close(out);
+            unlink(copy_name.c_str());
+            if (!result.supported) {
+                break;
+            }
+        }
+        duration<double> elapsed = steady_clock::now() - start;
+        result.seconds = elapsed.count();
+        result.cpuSeconds = thread_cpu_seconds() - cpu_start;
+        results.push_back(result);
+    }
+    return results;
+}
+
+// ---- Metadata workload ----
+// -meta=N creates N small files spread over -fanout directories, then
+// stats, renames and unlinks them, every job taking every jobs-th file.
+enum MetaOp { MetaCreate, MetaWrite, MetaFsync, MetaDirsync, MetaStat,
+    MetaRename, MetaUnlink, META_OPS };
+
+struct MetaResult {
+    const char *op;
+    uint64_t count = 0;
+    double opsPerSec = 0;  // over the wall time of the pass the op is in
+    LatencyHistogram latency;
+};
+
+string meta_dir(const string &root, size_t file, int fanout) {
+    return root + "/d" + to_string(file % fanout);
+}
+
+string meta_file(const string &root, size_t file, int fanout) {
+    return meta_dir(root, file, fanout) + "/f" + to_string(file);
+}
+
+vector<MetaResult> run_metadata(const Config &config, const string &mount_path,
+    BufferArena &arena) {
+    string root = mount_path + "/meta_" + to_string(getpid());
+    for (int d = 0; d < config.metaFanout; ++d) {
+        error_code ec;
+        fs::create_directories(root + "/d" + to_string(d), ec);
+        if (ec) {
+            cerr << "Cannot create " << root << ": " << ec.message() << '\n';
+            throw string_view("run_metadata/mkdir");
+        }
+    }
+    // one task per job, the offset holds the job number
+    vector<vector<IoTask>> tasks(config.jobs);
+    for (int j = 0; j < config.jobs; ++j) {
+        IoTask task;
+        task.filename = root;
+        task.offset = j;
+        tasks[j].push_back(task);
+    }
+    vector<array<LatencyHistogram, META_OPS>> latency(config.jobs);
+    vector<MetaResult> results(META_OPS);
+    const char *names[] = {"create", "write", "fsync", "dirsync", "stat",
+        "rename", "unlink"};
+    for (int op = 0; op < META_OPS; ++op) {
+        results[op].op = names[op];
+    }
+
+    // Time one call into the histogram of its operation
+    auto timed = [&](size_t job, MetaOp op, auto call) {
+        uint64_t start = now_ns();
+        bool ok = call();
+        latency[job][op].record(now_ns() - start);
+        return ok;
+    };
+    auto dirsync = [&](size_t job, const string &dir) {
+        if (!config.metaDirsync) {
+            return true;
+        }
+        return timed(job, MetaDirsync, [&] {
+            int fd = open(dir.c_str(), O_RDONLY);
+            bool ok = fd >= 0 && fsync(fd) == 0;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return ok;
+        });
+    };
+    // wall time of the pass of every operation
+    array<double, META_OPS> seconds{};
+    auto pass = [&](initializer_list<MetaOp> ops, auto body) {
+        PhaseResult phase = run_phase(tasks, config, arena, true,
+            [&](const IoTask &task, AlignedBuffer &buffer, JobStats &) {
+                size_t job = task.offset;
+                for (size_t i = job; i < config.metaFiles; i += config.jobs) {
+                    body(job, i, buffer);
+                }
+                return uint8_t(0);
+            });
+        for (MetaOp op : ops) {
+            seconds[op] = phase.seconds;
+        }
+    };
+
+    try {
+        pass({MetaCreate, MetaWrite, MetaFsync, MetaDirsync},
+            [&](size_t job, size_t i, AlignedBuffer &buffer) {
+            string name = meta_file(root, i, config.metaFanout);
+            int fd = -1;
+            if (!timed(job, MetaCreate, [&] {
+                fd = open(name.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+                return fd >= 0;
+            })) {
+                perror("create");
+                throw string_view("run_metadata/create");
+            }
+            bool ok = timed(job, MetaWrite, [&] {
+                for (size_t done = 0; done < config.metaSize; ) {
+                    size_t chunk = min(buffer.size(), config.metaSize - done);
+                    ssize_t n = write(fd, buffer.data(), chunk);
+                    if (n <= 0) {
+                        return false;
+                    }
+                    done += n;
+                }
+                return true;
+            }) && timed(job, MetaFsync, [&] { return fsync(fd) == 0; });
+            if (!ok) {
+                perror("write");
+                close(fd);
+                throw string_view("run_metadata/write");
+            }
+            close(fd);
+            if (!dirsync(job, meta_dir(root, i, config.metaFanout))) {
+                perror("dirsync");
+                throw string_view("run_metadata/dirsync");
+            }
+        });
+        pass({MetaStat}, [&](size_t job, size_t i, AlignedBuffer &) {
+            string name = meta_file(root, i, config.metaFanout);
+            struct stat st;
+            if (!timed(job, MetaStat, [&] {
+                return stat(name.c_str(), &st) == 0;
+            })) {
+                perror("stat");
+                throw string_view("run_metadata/stat");
+            }
+        });
+        pass({MetaRename, MetaDirsync}, [&](size_t job, size_t i,
+            AlignedBuffer &) {
+            string name = meta_file(root, i, config.metaFanout);
+            if (!timed(job, MetaRename, [&] {
+                return rename(name.c_str(), (name + ".r").c_str()) == 0;
+            }) || !dirsync(job, meta_dir(root, i, config.metaFanout))) {
+                perror("rename");
+                throw string_view("run_metadata/rename");
+            }
+        });
+        pass({MetaUnlink, MetaDirsync}, [&](size_t job, size_t i,
+            AlignedBuffer &) {
+            string name = meta_file(root, i, config.metaFanout) + ".r";
+            if (!timed(job, MetaUnlink, [&] {
+                return unlink(name.c_str()) == 0;
+            }) || !dirsync(job, meta_dir(root, i, config.metaFanout))) {
+                perror("unlink");
+                throw string_view("run_metadata/unlink");
+            }
+        });
+    }
+    catch (...) {
+        error_code ec;
+        fs::remove_all(root, ec);
+        throw;
+    }
+    error_code ec;
+    fs::remove_all(root, ec);
+    for (int op = 0; op < META_OPS; ++op) {
+        for (int j = 0; j < config.jobs; ++j) {
+            results[op].latency.merge(latency[j][op]);
+        }
+        results[op].count = results[op].latency.count();
+        // the directory syncs are spread over three passes
+        if (op != MetaDirsync) {
+            results[op].opsPerSec = results[op].count / seconds[op];
+        }
+    }
+    if (!config.metaDirsync) {
+        results.erase(results.begin() + MetaDirsync);
+    }
+    return results;
+}
+
+void print_metadata(const Config &config, const vector<MetaResult> &results) {
+    cout << "Metadata: " << config.metaFiles << " files of " <<
+        config.metaSize << " B in " << config.metaFanout << " directories\n";
+    for (const auto &result : results) {
+        cout << "  " << left << setw(8) << result.op << right << result.count <<
+            " ops";
+        if (result.opsPerSec > 0) {
+            cout << ", " << result.opsPerSec << " ops/s";
+        }
+        cout << " | latency, us: p50 " << result.latency.percentile(0.5) / 1e3 <<
+            " | p99 " << result.latency.percentile(0.99) / 1e3 << " | p99.9 " <<
+            result.latency.percentile(0.999) / 1e3 << " | max " <<
+            result.latency.maxValue() / 1e3 << '\n';
+    }
+}
+
+// Reads and writes of a mixed phase
+struct MixResult {
+    int reads = 0;             // the requested ratio
+    int writes = 0;
+    double readSpeed = 0;      // MB/s
+    double writeSpeed = 0;
+    LatencyHistogram readLatency;
+    LatencyHistogram writeLatency;
+};
+
+// One open-loop phase of -rate
+struct RatedPhase {
+    double targetIops = 0;
+    double iops = 0;           // achieved
+    double speed = 0;          // MB/s
+    LatencyHistogram latency;  // from the intended start of every operation
+    LatencyHistogram service;  // of the I/O calls alone
+};
+
+struct RateResult {
+    RateTarget target;
+    RatedPhase write;
+    RatedPhase read;
+};
+
+// An achieved rate this far below the target fell behind the schedule
+constexpr double RATE_KEPT = 0.95;
+
+// Results of one size step
+struct StepResult {
+    PhaseResult write;
+    PhaseResult read;
+    double writeSpeed = 0; // MB/s
+    double readSpeed = 0;
+    double writeIops = 0;
+    double readIops = 0;
+    vector<CopyResult> copies;
+    vector<MixResult> mixes;
+    vector<RateResult> rates;
+    vector<long> extents;  // of every file after the write phase, FIEMAP
+};
+
+size_t phase_bytes(const PhaseResult &phase) {
+    return accumulate(phase.jobBytes.begin(), phase.jobBytes.end(), size_t(0));
+}
+
+// Bytes behind the usage, perf and io figures: those of every trial
+size_t counted_bytes(const PhaseResult &phase) {
+    return phase_bytes(phase) * phase.trials;
+}
+
+// IOPS of a load level, relative levels against a closed-loop phase
+double target_iops(const RateTarget &target, const PhaseResult &closed,
+    size_t block) {
+    switch (target.unit) {
+    case RateUnit::Iops:
+        return target.value;
+    case RateUnit::MBps:
+        return target.value * (1 << 20) / block;
+    case RateUnit::Peak:
+        break;
+    }
+    return closed.latency.count() / closed.seconds * target.value / 100;
+}
+
+// Write the files of a size step, drop them from the cache and read them
+// back. Exits on an I/O error.
+StepResult run_step(const Config &config, const string &mount_path,
+    size_t size_bytes, BufferArena &arena) {
+    const EngineEntry &engine = engine_for(config.function);
+    WriteFile test_write = engine.write;
+    ReadFile test_read = engine.read;
+
+    vector<string> filenames;
+    filenames.reserve(config.iterations * config.jobs);
+    StepResult step;
+    string device = block_device(mount_path);
+    IoCounters before;
+    try
+    {
+        auto tasks = make_tasks(config, mount_path, size_bytes,
+            filenames);
+        // Write test
+        try {
+            for (const auto &filename : filenames) {
+                cout << "filename: " << filename << "\n";
+                prepare_file(filename, size_bytes, config);
+            }
+            before = io_counters(device);
+            step.write = run_phase(tasks, config, arena,
+                true, [&](const IoTask &task, AlignedBuffer &buffer,
+                    JobStats &stats) {
+                    test_write(task, buffer, config, stats);
+                    return uint8_t(0);
+                });
+            step.write.io = io_counters(device) - before;
+        }
+        catch (string_view msg) {
+            cout << "Error ocuured at " << msg << endl;
+            throw 0;
+        }
+        for (const auto &filename : filenames) {
+            long extents = file_extents(filename);
+            if (extents < 0) {
+                step.extents.clear();
+                break;
+            }
+            step.extents.push_back(extents);
+        }
+
+        // Drop the written data from the page cache so the
+        // read phase measures the device
+        if (config.directIO) {
+            for (const auto &filename : filenames) {
+                evict_file_cache(filename);
+            }
+        }
+
+        // Read test
+        try {
+            before = io_counters(device);
+            step.read = run_phase(tasks, config, arena,
+                false, [&](const IoTask &task, AlignedBuffer &buffer,
+                    JobStats &stats) {
+                    // to prevent an optimization
+                    return test_read(task, buffer, config, stats);
+                });
+            step.read.io = io_counters(device) - before;
+        }
+        catch (string_view msg) {
+            cout << "Error ocuured at " << msg << endl;
+            throw 0;
+        }
+        cout << "sink = " << (int)step.read.sink << endl;
+
+        // Mixed phases: every job reads its regions back and overwrites them
+        // at once, each operation a write with the share of the ratio
+        for (const auto &[reads, writes] : config.mixes) {
+            MixResult mix;
+            mix.reads = reads;
+            mix.writes = writes;
+            auto mix_tasks = tasks;
+            for (auto &job : mix_tasks) {
+                for (auto &task : job) {
+                    task.writeShare = double(writes) / (reads + writes);
+                }
+            }
+            if (config.directIO) {
+                for (const auto &filename : filenames) {
+                    evict_file_cache(filename);
+                }
+            }
+            PhaseResult phase;
+            try {
+                phase = run_phase(mix_tasks, config, arena, true,
+                    [&](const IoTask &task, AlignedBuffer &buffer,
+                        JobStats &stats) {
+                        return engine.mix(task, buffer, config, stats);
+                    }, true);
+            }
+            catch (string_view msg) {
+                cout << "Error ocuured at " << msg << endl;
+                throw 0;
+            }
+            if (phase.seconds > 0) {
+                mix.readSpeed = (phase_bytes(phase) - phase.writtenBytes) /
+                    double(1 << 20) / phase.seconds;
+                mix.writeSpeed = phase.writtenBytes / double(1 << 20) /
+                    phase.seconds;
+            }
+            mix.readLatency = phase.latency;
+            mix.writeLatency = phase.writeLatency;
+            step.mixes.push_back(mix);
+        }
+
+        // Rated phases: the files are written and read again open loop at
+        // every -rate level
+        for (const auto &target : config.rates) {
+            RateResult rate;
+            rate.target = target;
+            for (bool write : {true, false}) {
+                const PhaseResult &closed = write ? step.write : step.read;
+                Config paced = config;
+                paced.paceIops = target_iops(target, closed, block_size(config));
+                if (!write && config.directIO) {
+                    for (const auto &filename : filenames) {
+                        evict_file_cache(filename);
+                    }
+                }
+                PhaseResult phase;
+                try {
+                    phase = run_phase(tasks, paced, arena, write,
+                        [&](const IoTask &task, AlignedBuffer &buffer,
+                            JobStats &stats) {
+                            if (write) {
+                                test_write(task, buffer, paced, stats);
+                                return uint8_t(0);
+                            }
+                            return test_read(task, buffer, paced, stats);
+                        });
+                }
+                catch (string_view msg) {
+                    cout << "Error ocuured at " << msg << endl;
+                    throw 0;
+                }
+                auto &rated = write ? rate.write : rate.read;
+                rated.targetIops = paced.paceIops;
+                rated.iops = phase.latency.count() / phase.seconds;
+                rated.speed = phase_bytes(phase) / double(1 << 20) /
+                    phase.seconds;
+                rated.latency = phase.latency;
+                rated.service = phase.service;
+            }
+            step.rates.push_back(rate);
+        }
+
+        if (config.copy) {
+            try {
+                step.copies = run_copies(config, filenames, size_bytes,
+                    arena);
+            }
+            catch (string_view msg) {
+                cout << "Error ocuured at " << msg << endl;
+                throw 0;
+            }
+        }
+    }
+    catch (...) {
+        cleanup(filenames);
+        exit(1);
+    }
+    cleanup(filenames);
+
+    size_t size_mb = size_bytes / (1 << 20);
+    double total_mb = static_cast<double>(size_mb * config.iterations) *
+        (config.sharedFile ? 1 : config.jobs);
+    step.writeSpeed = total_mb / step.write.seconds;
+    step.readSpeed = total_mb / step.read.seconds;
+    // one operation per block
+    double total_ops = static_cast<double>(config.iterations) *
+        (config.sharedFile ? 1 : config.jobs) *
+        ((size_bytes + block_size(config) - 1) / block_size(config));
+    step.writeIops = total_ops / step.write.seconds;
+    step.readIops = total_ops / step.read.seconds;
+    return step;
+}
+
+// CPU time of the jobs per byte they moved, ns
+double cpu_ns_per_byte(const PhaseResult &phase) {
+    size_t bytes = counted_bytes(phase);
+    return bytes ? double(phase.usage.userNs + phase.usage.systemNs) / bytes :
+        NAN;
+}
+
+// Bytes the device moved per byte the jobs moved, NaN without diskstats
+double device_amplification(const PhaseResult &phase, bool write) {
+    size_t bytes = counted_bytes(phase);
+    if (!phase.io.disk.valid || bytes == 0) {
+        return NAN;
+    }
+    uint64_t sectors = phase.mixed ? phase.io.disk.readSectors +
+        phase.io.disk.writeSectors : write ? phase.io.disk.writeSectors :
+        phase.io.disk.readSectors;
+    return sectors * 512.0 / bytes;
+}
+
+// What the phase cost the host: CPU, scheduling, counters and device I/O,
+// summed over the trials
+void print_efficiency(const char *name, const PhaseResult &phase, bool write) {
+    size_t bytes = counted_bytes(phase);
+    if (bytes == 0) {
+        return;
+    }
+    const auto &usage = phase.usage;
+    const auto &perf = phase.perf;
+    string trials = phase.trials > 1 ? " (" + to_string(phase.trials) +
+        " trials)" : "";
+    cout << "  " << name << " CPU" << trials << ": " << cpu_ns_per_byte(phase) <<
+        " ns/B (user " << usage.userNs / 1e6 << " ms, sys " <<
+        usage.systemNs / 1e6 << " ms) | " <<
+        usage.voluntarySwitches << " voluntary, " << usage.involuntarySwitches <<
+        " involuntary switches";
+    if (perf[0] > 0) {
+        cout << " | " << double(perf[0]) / bytes << " cycles/B";
+        if (perf[1] >= 0) {
+            cout << ", IPC " << double(perf[1]) / perf[0];
+        }
+    }
+    if (perf[2] >= 0) {
+        cout << ", " << perf[2] << " cache misses";
+    }
+    if (perf[4] >= 0) {
+        cout << ", " << perf[4] << " migrations";
+    }
+    cout << '\n';
+    const auto &disk = phase.io.disk;
+    if (disk.valid) {
+        cout << "  " << name << " device: " << disk.readSectors * 512.0 / (1 << 20) <<
+            " MB read in " << disk.reads << " requests (" << disk.readMerges <<
+            " merged), " << disk.writeSectors * 512.0 / (1 << 20) <<
+            " MB written in " << disk.writes << " (" << disk.writeMerges <<
+            " merged) | amplification " << device_amplification(phase, write) <<
+            '\n';
+    }
+    const auto &process = phase.io.process;
+    if (process.valid) {
+        cout << "  " << name << " process I/O: " << process.readCalls <<
+            " read and " << process.writeCalls << " write calls, storage " <<
+            process.readBytes / double(1 << 20) << " MB read, " <<
+            process.writeBytes / double(1 << 20) << " MB written\n";
+    }
+}
+
+void print_step(const Config &config, size_t size_bytes, const StepResult &step) {
+    cout << "Size: " << size_bytes / (1 << 20) << " MB | Write: " <<
+    step.writeSpeed << " MB/s, " << step.writeIops << " IOPS | Read: " <<
+    step.readSpeed << " MB/s, " << step.readIops << " IOPS\n";
+    print_latency("Write", step.write.latency);
+    print_latency("Read", step.read.latency);
+    if (step.write.commit.count()) {
+        print_latency("Commit", step.write.commit);
+    }
+    if (config.sampleMs) {
+        print_timeline("Write", step.write, config.sampleMs);
+        print_timeline("Read", step.read, config.sampleMs);
+    }
+    if (!step.extents.empty()) {
+        auto max_extents = *max_element(step.extents.begin(),
+            step.extents.end());
+        cout << "  Extents: " << accumulate(step.extents.begin(),
+            step.extents.end(), 0L) << " in " << step.extents.size() <<
+            " files, at most " << max_extents << " per file\n";
+    }
+    cout << "  Page faults: write " << step.write.usage.majorFaults <<
+        " major, " << step.write.usage.minorFaults << " minor | read " <<
+        step.read.usage.majorFaults << " major, " <<
+        step.read.usage.minorFaults << " minor\n";
+    print_efficiency("Write", step.write, true);
+    print_efficiency("Read", step.read, false);
+#ifdef HAVE_PREADV2
+    if (config.rwFlags & RWF_NOWAIT) {
+        cout << "  RWF_NOWAIT: write " << step.write.nowaitAgain << " EAGAIN, " <<
+            step.write.nowaitShort << " short of " << step.write.latency.count() <<
+            " calls | read " << step.read.nowaitAgain << " EAGAIN, " <<
+            step.read.nowaitShort << " short of " << step.read.latency.count() <<
+            " calls\n";
+    }
+#endif
+    if (config.verify) {
+        cout << "  Verify: " << step.read.verifiedBlocks <<
+            " blocks, " << step.read.corruptBlocks << " corrupt | CPU, ms:"
+            " stamp " << step.write.verifyNs / 1e6 << ", check " <<
+            step.read.verifyNs / 1e6 << '\n';
+    }
+    if (config.jobs > 1) {
+        print_job_speeds("Write", step.write);
+        print_job_speeds("Read", step.read);
+    }
+    for (const auto &mix : step.mixes) {
+        cout << "  Mix " << mix.reads << ':' << mix.writes << " | Read: " <<
+            mix.readSpeed << " MB/s | Write: " << mix.writeSpeed << " MB/s\n";
+        if (mix.reads) {
+            print_latency("  Read", mix.readLatency);
+        }
+        if (mix.writes) {
+            print_latency("  Write", mix.writeLatency);
+        }
+    }
+    for (const auto &rate : step.rates) {
+        cout << "  Rate " << rate_label(rate.target);
+        for (const auto &[name, rated] : {make_pair("Write", &rate.write),
+            make_pair("Read", &rate.read)}) {
+            cout << " | " << name << ": " << rated->iops << " of " <<
+                rated->targetIops << " IOPS, " << rated->speed << " MB/s" <<
+                (rated->iops < rated->targetIops * RATE_KEPT ? " (behind)" : "");
+        }
+        cout << '\n';
+        print_latency("  Write", rate.write.latency);
+        print_latency("  Write service", rate.write.service);
+        print_latency("  Read", rate.read.latency);
+        print_latency("  Read service", rate.read.service);
+    }
+    double copy_mb = static_cast<double>(size_bytes / (1 << 20)) *
+        config.iterations * (config.sharedFile ? 1 : config.jobs);
+    for (const auto &copy : step.copies) {
+        cout << "  Copy " << left << setw(16) << copy.method;
+        if (copy.supported) {
+            cout << copy_mb / copy.seconds << " MB/s | CPU " << copy.cpuSeconds <<
+                " s (" << copy.cpuSeconds / copy.seconds * 100 << "%)\n";
+        }
+        else {
+            cout << "not supported\n";
+        }
+        cout << right;
+    }
+}
+
+string_view func_name(Func func) {
+    switch(func) {
+        case Func::ReadWrite: return "read/write";
+        case Func::PReadWrite: return "pread/pwrite";
+        case Func::FStream: return "fstream";
+        case Func::MMap: return "mmap";
+        case Func::Uring: return "io_uring";
+        case Func::PReadWriteV: return "preadv2/pwritev2";
+    }
+}
+
+// ---- Traces ----
+// -record captures the operations of the write and read phases, -convert
+// turns a text trace into the binary format and -replay runs a trace through
+// an engine. Every slot of a trace is a file and a stream: its operations are
+// replayed in order by one job, the slots are spread over the jobs.
+
+class TraceWriter {
+public:
+    explicit TraceWriter(const string &path) : out_(path, ios::binary) {
+        if (!out_) {
+            throw invalid_argument("cannot write " + path);
+        }
+        out_.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    }
+
+    // Records of a phase with now_ns() timestamps, made relative to the
+    // first record written
+    void append(vector<TraceRecord> records) {
+        sort(records.begin(), records.end(), [](const auto &a, const auto &b) {
+            return a.timestampNs < b.timestampNs;
+        });
+        for (auto &record : records) {
+            if (count_++ == 0) {
+                base_ = record.timestampNs;
+            }
+            record.timestampNs -= base_;
+        }
+        out_.write(reinterpret_cast<const char *>(records.data()),
+            records.size() * sizeof(TraceRecord));
+    }
+
+    size_t count() const { return count_; }
+
+private:
+    ofstream out_;
+    uint64_t base_ = 0;
+    size_t count_ = 0;
+};
+
+vector<TraceRecord> read_trace(const string &path) {
+    ifstream in(path, ios::binary);
+    char magic[sizeof(TRACE_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) ||
+        memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        throw invalid_argument(path + " is not a trace file");
+    }
+    vector<TraceRecord> records;
+    TraceRecord record;
+    while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        if (record.op > TraceOp::Fsync) {
+            throw invalid_argument(path + ": bad operation in record " +
+                to_string(records.size()));
+        }
+        records.push_back(record);
+    }
+    return records;
+}
+
+// Text trace, one operation per line: "<time, us> <R|W|F> <slot> <offset>
+// <length> [flags]"; # starts a comment. Returns the number of records.
+size_t convert_trace(const string &text_path, const string &trace_path) {
+    ifstream in(text_path);
+    if (!in) {
+        throw invalid_argument("cannot read " + text_path);
+    }
+    vector<TraceRecord> records;
+    string line;
+    size_t line_number = 0;
+    while (getline(in, line)) {
+        ++line_number;
+        line = line.substr(0, line.find('#'));
+        istringstream fields(line);
+        double time_us;
+        string op;
+        if (!(fields >> time_us)) {
+            continue;
+        }
+        TraceRecord record{};
+        unsigned slot = 0;
+        unsigned flags = 0;
+        // a sync has no offset and length
+        if (!(fields >> op >> slot) || (op != "R" && op != "W" && op != "F") ||
+            slot > UINT16_MAX || time_us < 0 ||
+            (op != "F" && !(fields >> record.offset >> record.length))) {
+            throw invalid_argument(text_path + ":" + to_string(line_number) +
+                ": expected <time, us> <R|W|F> <slot> <offset> <length>");
+        }
+        fields >> flags;
+        record.timestampNs = static_cast<uint64_t>(time_us * 1e3);
+        record.slot = slot;
+        record.op = op == "R" ? TraceOp::Read : op == "W" ? TraceOp::Write :
+            TraceOp::Fsync;
+        record.flags = flags;
+        records.push_back(record);
+    }
+    stable_sort(records.begin(), records.end(), [](const auto &a, const auto &b) {
+        return a.timestampNs < b.timestampNs;
+    });
+    ofstream out(trace_path, ios::binary);
+    if (!out) {
+        throw invalid_argument("cannot write " + trace_path);
+    }
+    out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    out.write(reinterpret_cast<const char *>(records.data()),
+        records.size() * sizeof(TraceRecord));
+    return records.size();
+}
+
+struct ReplayResult {
+    PhaseResult phase;
+    size_t streams = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t syncs = 0;
+    uint64_t readBytes = 0;
+    uint64_t writeBytes = 0;
+    double speed = 0;         // MB/s of reads and writes together
+    double iops = 0;
+};
+
+ReplayResult run_replay(const Config &config, const string &mount_path,
+    BufferArena &arena) {
+    const EngineEntry &engine = engine_for(config.function);
+    if (!engine.replay) {
+        throw invalid_argument("traces can be replayed by the prw and prwv "
+            "functions only");
+    }
+    vector<TraceRecord> records = read_trace(config.replayPath);
+    ReplayResult result;
+    size_t alignment = direct_io_alignment(mount_path);
+    size_t buffer = max(config.bufferSize, block_size(config));
+    vector<size_t> file_sizes;
+    for (const auto &record : records) {
+        if (record.slot >= file_sizes.size()) {
+            file_sizes.resize(record.slot + 1);
+        }
+        if (record.op == TraceOp::Fsync) {
+            ++result.syncs;
+            continue;
+        }
+        if (record.length > buffer) {
+            throw invalid_argument("the trace has " + to_string(record.length) +
+                " B operations, raise -buf");
+        }
+        if (config.directIO && (record.offset % alignment ||
+            record.length % alignment)) {
+            throw invalid_argument("the trace has operations not aligned to " +
+                to_string(alignment) + " B for direct I/O, use -c");
+        }
+        file_sizes[record.slot] = max<size_t>(file_sizes[record.slot],
+            record.offset + record.length);
+        if (record.op == TraceOp::Read) {
+            ++result.reads;
+            result.readBytes += record.length;
+        }
+        else {
+            ++result.writes;
+            result.writeBytes += record.length;
+        }
+    }
+
+    // every slot is a file written in full, so reads find allocated data
+    Config prepare = config;
+    prepare.layout = Layout::Overwrite;
+    vector<string> filenames;
+    vector<ReplayJob> jobs(config.jobs);
+    // one task per job, the offset holds the job number
+    vector<vector<IoTask>> tasks(config.jobs, vector<IoTask>(1));
+    for (int j = 0; j < config.jobs; ++j) {
+        tasks[j][0].offset = j;
+    }
+    auto close_all = [&] {
+        for (auto &job : jobs) {
+            for (int fd : job.fds) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+        cleanup(filenames);
+    };
+    try {
+        for (size_t slot = 0; slot < file_sizes.size(); ++slot) {
+            string filename = mount_path + "/replay_" + to_string(slot) + ".bin";
+            filenames.push_back(filename);
+            prepare_file(filename, max<size_t>(file_sizes[slot], 1), prepare);
+            if (config.directIO) {
+                evict_file_cache(filename);
+            }
+            auto &job = jobs[slot % config.jobs];
+            job.fds.resize(file_sizes.size(), -1);
+            job.fds[slot] = open_file(filename, O_RDWR, config.directIO);
+            if (job.fds[slot] < 0) {
+                perror("open replay");
+                throw string_view("run_replay/open");
+            }
+            ++result.streams;
+        }
+        for (const auto &record : records) {
+            auto &job = jobs[record.slot % config.jobs];
+            job.records.push_back(record);
+            tasks[record.slot % config.jobs][0].size += record.op ==
+                TraceOp::Fsync ? 0 : record.length;
+        }
+        atomic<uint64_t> origin{0};
+        string device = block_device(mount_path);
+        IoCounters before = io_counters(device);
+        result.phase = run_phase(tasks, config, arena, true,
+            [&](const IoTask &task, AlignedBuffer &buffer, JobStats &stats) {
+                return engine.replay(jobs[task.offset], buffer, config, origin,
+                    stats);
+            });
+        result.phase.io = io_counters(device) - before;
+        result.phase.mixed = result.reads && result.writes;
+    }
+    catch (...) {
+        close_all();
+        throw;
+    }
+    close_all();
+    double mb = (result.readBytes + result.writeBytes) / double(1 << 20);
+    result.speed = result.phase.seconds > 0 ? mb / result.phase.seconds : 0;
+    result.iops = result.phase.seconds > 0 ?
+        (result.reads + result.writes) / result.phase.seconds : 0;
+    return result;
+}
+
+void print_replay(const Config &config, const ReplayResult &result) {
+    cout << "Replay: " << result.reads + result.writes << " operations on " <<
+        result.streams << " streams, " << result.readBytes / double(1 << 20) <<
+        " MB read, " << result.writeBytes / double(1 << 20) << " MB written in " <<
+        result.phase.seconds << " s | " << result.speed << " MB/s, " <<
+        result.iops << " IOPS\n";
+    print_latency("Replay", result.phase.latency);
+    if (result.phase.commit.count()) {
+        print_latency("Commit", result.phase.commit);
+    }
+    if (config.replayOriginal) {
+        cout << "  Behind the trace timing, us: max " <<
+            result.phase.lagNs / 1e3 << '\n';
+    }
+    if (config.sampleMs) {
+        print_timeline("Replay", result.phase, config.sampleMs);
+    }
+    print_efficiency("Replay", result.phase, result.writeBytes > 0);
+}
+
+// ---- Structured results ----
+// One record per size step and variant, written as JSON or CSV and compared
+// against a baseline written by an earlier run.
+struct StepRecord {
+    string variant;  // mmap or sync policy of the step, "" without a sweep
+    size_t sizeBytes = 0;
+    size_t bufferSize = 0;
+    StepResult result;
+};
+
+string variant_name(const Config &config) {
+    string name;
+    if (config.mmapSweep.size() > 1) {
+        name = mmapPolicyName(config.mmap);
+    }
+    else if (config.syncSweep.size() > 1) {
+        name = syncPolicyName(config.sync);
+    }
+    if (config.numaSweep.size() > 1) {
+        name += (name.empty() ? "" : ", ") + string("numa ") +
+            to_string(config.numaNode);
+    }
+    return name;
+}
+
+// Speeds of the trials of a phase, or of its jobs in a single trial, MB/s
+vector<double> phase_samples(const PhaseResult &phase) {
+    if (phase.trialSpeeds.size() > 1) {
+        return phase.trialSpeeds;
+    }
+    vector<double> samples;
+    for (size_t j = 0; j < phase.jobBytes.size(); ++j) {
+        if (phase.jobSeconds[j] > 0) {
+            samples.push_back(phase.jobBytes[j] / double(1 << 20) /
+                phase.jobSeconds[j]);
+        }
+    }
+    return samples;
+}
+
+// p99 latencies of the trials of a phase, or of its jobs in a single trial, us
+vector<double> latency_samples(const PhaseResult &phase) {
+    if (phase.trialP99.size() > 1) {
+        return phase.trialP99;
+    }
+    vector<double> samples;
+    for (const auto &latency : phase.jobLatency) {
+        if (latency.count()) {
+            samples.push_back(latency.percentile(0.99) / 1e3);
+        }
+    }
+    return samples;
+}
+
+string json_string(const string &str) {
+    ostringstream oss;
+    oss << '"';
+    for (char c : str) {
+        switch (c) {
+        case '"': oss << "\\\""; break;
+        case '\\': oss << "\\\\"; break;
+        case '\n': oss << "\\n"; break;
+        case '\t': oss << "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                oss << "\\u" << hex << setw(4) << setfill('0') << int(c) <<
+                    dec << setfill(' ');
+            }
+            else {
+                oss << c;
+            }
+        }
+    }
+    oss << '"';
+    return oss.str();
+}
+
+// JSON has no infinities and NaNs
+string json_number(double value) {
+    if (!isfinite(value)) {
+        return "null";
+    }
+    ostringstream oss;
+    oss << setprecision(10) << value;
+    return oss.str();
+}
+
+// Host, kernel, file system and device of the test directory
+struct SystemInfo {
+    string host;
+    string os;
+    string kernel;
+    string machine;
+    string filesystem = "unknown";
+    string device = "none";
+    string model;
+    int rotational = -1;
+    size_t logicalBlockSize = 0;
+    int numaNode = -1;                 // of the device
+};
+
+SystemInfo system_info(const string &path) {
+    SystemInfo info;
+    utsname uts;
+    if (uname(&uts) == 0) {
+        info.host = uts.nodename;
+        info.os = uts.sysname;
+        info.kernel = uts.release;
+        info.machine = uts.machine;
+    }
+    info.logicalBlockSize = direct_io_alignment(path);
+    info.numaNode = device_numa_node(path);
+    struct statfs sfs;
+    if (statfs(path.c_str(), &sfs) == 0) {
+#ifdef __APPLE__
+        info.filesystem = sfs.f_fstypename;
+        info.device = sfs.f_mntfromname;
+#else
+        const pair<unsigned long, const char *> types[] = {
+            {0xEF53, "ext4"}, {0x58465342, "xfs"}, {0x9123683E, "btrfs"},
+            {0x01021994, "tmpfs"}, {0x958458f6, "hugetlbfs"},
+            {0x794c7630, "overlayfs"}, {0x6969, "nfs"}, {0x2fc12fc1, "zfs"},
+            {0xF2F52010, "f2fs"}, {0x65735546, "fuse"}, {0x4d44, "vfat"}};
+        ostringstream type;
+        type << "0x" << hex << static_cast<unsigned long>(sfs.f_type);
+        info.filesystem = type.str();
+        for (const auto &[magic, name] : types) {
+            if (static_cast<unsigned long>(sfs.f_type) == magic) {
+                info.filesystem = name;
+            }
+        }
+#endif
+    }
+#ifdef __linux__
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && major(st.st_dev) != 0) {
+        string dev = "/sys/dev/block/" + to_string(major(st.st_dev)) + ":" +
+            to_string(minor(st.st_dev));
+        if (!block_device(path).empty()) {
+            info.device = block_device(path);
+        }
+        // a partition keeps the device attributes in its parent
+        for (const char *parent : {"", "/.."}) {
+            ifstream model(dev + parent + "/device/model");
+            if (getline(model, info.model)) {
+                info.model.erase(info.model.find_last_not_of(" \n") + 1);
+                ifstream rotational(dev + parent + "/queue/rotational");
+                rotational >> info.rotational;
+                break;
+            }
+        }
+    }
+#endif
+    return info;
+}
+
+void write_phase_json(ostream &out, const char *name, const PhaseResult &phase,
+    double speed, double iops, bool write) {
+    out << "        " << json_string(name) << ": {\"speed\": " <<
+        json_number(speed) << ", \"iops\": " << json_number(iops) <<
+        ", \"seconds\": " << json_number(phase.seconds) << ", \"samples\": [";
+    vector<double> samples = phase_samples(phase);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        out << (i ? ", " : "") << json_number(samples[i]);
+    }
+    out << "], \"p99Samples\": [";
+    samples = latency_samples(phase);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        out << (i ? ", " : "") << json_number(samples[i]);
+    }
+    out << "], \"timeline\": [";
+    for (size_t i = 0; i < phase.timeline.size(); ++i) {
+        out << (i ? ", " : "") << '[' << json_number(phase.timeline[i].first) <<
+            ", " << phase.timeline[i].second << ']';
+    }
+    out << "], \"latencyUs\": {\"p50\": " <<
+        json_number(phase.latency.percentile(0.5) / 1e3) << ", \"p99\": " <<
+        json_number(phase.latency.percentile(0.99) / 1e3) << ", \"p999\": " <<
+        json_number(phase.latency.percentile(0.999) / 1e3) << ", \"max\": " <<
+        json_number(phase.latency.maxValue() / 1e3) << "}, \"commitP99Us\": " <<
+        json_number(phase.commit.percentile(0.99) / 1e3) <<
+        ", \"majorFaults\": " << phase.usage.majorFaults << ", \"minorFaults\": " <<
+        phase.usage.minorFaults << ", \"verifiedBlocks\": " << phase.verifiedBlocks <<
+        ", \"corruptBlocks\": " << phase.corruptBlocks << ",\n          \"cpu\": "
+        "{\"userNs\": " << phase.usage.userNs << ", \"systemNs\": " <<
+        phase.usage.systemNs << ", \"nsPerByte\": " <<
+        json_number(cpu_ns_per_byte(phase)) << ", \"voluntarySwitches\": " <<
+        phase.usage.voluntarySwitches << ", \"involuntarySwitches\": " <<
+        phase.usage.involuntarySwitches << "}, \"perf\": {";
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        out << (i ? ", " : "") << json_string(PERF_NAMES[i]) << ": " <<
+            (phase.perf[i] < 0 ? "null" : to_string(phase.perf[i]));
+    }
+    out << "}";
+    const auto &process = phase.io.process;
+    if (process.valid) {
+        out << ", \"process\": {\"readChars\": " << process.readChars <<
+            ", \"writeChars\": " << process.writeChars << ", \"readCalls\": " <<
+            process.readCalls << ", \"writeCalls\": " << process.writeCalls <<
+            ", \"readBytes\": " << process.readBytes << ", \"writeBytes\": " <<
+            process.writeBytes << "}";
+    }
+    const auto &disk = phase.io.disk;
+    if (disk.valid) {
+        out << ", \"device\": {\"reads\": " << disk.reads << ", \"readMerges\": " <<
+            disk.readMerges << ", \"readSectors\": " << disk.readSectors <<
+            ", \"writes\": " << disk.writes << ", \"writeMerges\": " <<
+            disk.writeMerges << ", \"writeSectors\": " << disk.writeSectors <<
+            ", \"amplification\": " << json_number(device_amplification(phase,
+            write)) << "}";
+    }
+    out << "}";
+}
+
+void write_json(const string &path, const Config &config,
+    const SystemInfo &info, const vector<StepRecord> &records,
+    const vector<MetaResult> &metadata, const ReplayResult *replay) {
+    ofstream out(path);
+    if (!out) {
+        throw invalid_argument("cannot write " + path);
+    }
+    string_view patterns[] = {"seq", "rand", "zipf", "hot"};
+    out << "{\n  \"system\": {\"host\": " << json_string(info.host) <<
+        ", \"os\": " << json_string(info.os) << ", \"kernel\": " <<
+        json_string(info.kernel) << ", \"machine\": " <<
+        json_string(info.machine) << ", \"filesystem\": " <<
+        json_string(info.filesystem) << ", \"device\": " <<
+        json_string(info.device) << ", \"model\": " << json_string(info.model) <<
+        ", \"rotational\": " << info.rotational << ", \"logicalBlockSize\": " <<
+        info.logicalBlockSize << ", \"numaNode\": " << info.numaNode << "},\n";
+    out << "  \"config\": {\"function\": " <<
+        json_string(string(func_name(config.function))) << ", \"minSize\": " <<
+        config.minSize << ", \"maxSize\": " << config.maxSize <<
+        ", \"strideSize\": " << config.strideSize << ", \"bufferSize\": " <<
+        config.bufferSize << ", \"bufferMax\": " << config.bufferMax <<
+        ", \"blockSize\": " << block_size(config) <<
+        ", \"iterations\": " << config.iterations << ", \"jobs\": " <<
+        config.jobs << ", \"sharedFile\": " << boolalpha << config.sharedFile <<
+        ", \"pattern\": " << json_string(string(patterns[int(config.pattern)])) <<
+        ", \"seed\": " << config.seed << ", \"zipfTheta\": " <<
+        json_number(config.zipfTheta) << ", \"hotAccess\": " <<
+        config.hotAccess << ", \"hotData\": " << config.hotData <<
+        ", \"useRamDisk\": " << config.useRamDisk << ", \"hugeRamDisk\": " <<
+        config.hugeRamDisk << ", \"directIO\": " << config.directIO <<
+        ", \"queueDepth\": " << config.queueDepth << ", \"uringFixed\": " <<
+        config.uringFixed << ", \"uringSqpoll\": " << config.uringSqpoll <<
+        ", \"layout\": " << json_string(string(layoutName(config.layout))) <<
+        ", \"metaFiles\": " << config.metaFiles << ", \"metaSize\": " <<
+        config.metaSize << ", \"metaFanout\": " << config.metaFanout <<
+        ", \"hugepages\": " << json_string(string(hugepagesName(config.hugepages))) <<
+        ", \"data\": " << json_string(data_label(config.data)) <<
+        ", \"sync\": " << json_string(sync_label(config)) <<
+        ", \"record\": " << json_string(config.recordPath) << ", \"replay\": " <<
+        json_string(config.replayPath) << ", \"timing\": " <<
+        json_string(config.replayOriginal ? "original" : "fast") << ", \"rates\": [";
+    for (size_t i = 0; i < config.rates.size(); ++i) {
+        out << (i ? ", " : "") << json_string(rate_label(config.rates[i]));
+    }
+    out << "]";
+    for (const auto &[name, list] : {make_pair("cpus", &config.cpus),
+        make_pair("numa", &config.numaSweep)}) {
+        out << ", \"" << name << "\": [";
+        for (size_t i = 0; i < list->size(); ++i) {
+            out << (i ? ", " : "") << (*list)[i];
         }
+        out << "]";
     }
-    file.close();
-    return checksum;
+    out << ", \"iovCount\": " <<
+        config.iovCount << ", \"rwFlags\": " <<
+        config.rwFlags << ", \"verify\": " << config.verify << ", \"copy\": " <<
+        config.copy << noboolalpha << "},\n";
+    out << "  \"steps\": [\n";
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto &record = records[i];
+        const auto &step = record.result;
+        out << "    {\"variant\": " << json_string(record.variant) <<
+            ", \"sizeBytes\": " << record.sizeBytes << ", \"bufferSize\": " <<
+            record.bufferSize << ",\n";
+        write_phase_json(out, "write", step.write, step.writeSpeed,
+            step.writeIops, true);
+        out << ",\n";
+        write_phase_json(out, "read", step.read, step.readSpeed,
+            step.readIops, false);
+        out << ",\n        \"mixes\": [";
+        for (size_t m = 0; m < step.mixes.size(); ++m) {
+            const auto &mix = step.mixes[m];
+            out << (m ? ", " : "") << "{\"reads\": " << mix.reads <<
+                ", \"writes\": " << mix.writes << ", \"readSpeed\": " <<
+                json_number(mix.readSpeed) << ", \"writeSpeed\": " <<
+                json_number(mix.writeSpeed) << ", \"readP99Us\": " <<
+                json_number(mix.readLatency.percentile(0.99) / 1e3) <<
+                ", \"writeP99Us\": " <<
+                json_number(mix.writeLatency.percentile(0.99) / 1e3) << "}";
+        }
+        out << "],\n        \"rates\": [";
+        for (size_t r = 0; r < step.rates.size(); ++r) {
+            const auto &rate = step.rates[r];
+            out << (r ? ", " : "") << "{\"target\": " <<
+                json_string(rate_label(rate.target));
+            for (const auto &[name, rated] : {make_pair("write", &rate.write),
+                make_pair("read", &rate.read)}) {
+                out << ", \"" << name << "\": {\"targetIops\": " <<
+                    json_number(rated->targetIops) << ", \"iops\": " <<
+                    json_number(rated->iops) << ", \"speed\": " <<
+                    json_number(rated->speed) << ", \"p50Us\": " <<
+                    json_number(rated->latency.percentile(0.5) / 1e3) <<
+                    ", \"p99Us\": " <<
+                    json_number(rated->latency.percentile(0.99) / 1e3) <<
+                    ", \"p999Us\": " <<
+                    json_number(rated->latency.percentile(0.999) / 1e3) <<
+                    ", \"serviceP99Us\": " <<
+                    json_number(rated->service.percentile(0.99) / 1e3) << "}";
+            }
+            out << "}";
+        }
+        out << "],\n        \"extents\": [";
+        for (size_t e = 0; e < step.extents.size(); ++e) {
+            out << (e ? ", " : "") << step.extents[e];
+        }
+        out << "],\n        \"copies\": [";
+        for (size_t c = 0; c < step.copies.size(); ++c) {
+            const auto &copy = step.copies[c];
+            out << (c ? ", " : "") << "{\"method\": " <<
+                json_string(copy.method) << ", \"supported\": " << boolalpha <<
+                copy.supported << noboolalpha << ", \"seconds\": " <<
+                json_number(copy.seconds) << ", \"cpuSeconds\": " <<
+                json_number(copy.cpuSeconds) << "}";
+        }
+        out << "]}" << (i + 1 < records.size() ? "," : "") << '\n';
+    }
+    out << "  ],\n  \"metadata\": [";
+    for (size_t i = 0; i < metadata.size(); ++i) {
+        const auto &result = metadata[i];
+        out << (i ? ",\n    " : "\n    ") << "{\"op\": " <<
+            json_string(result.op) << ", \"count\": " << result.count <<
+            ", \"opsPerSec\": " << json_number(result.opsPerSec) <<
+            ", \"latencyUs\": {\"p50\": " <<
+            json_number(result.latency.percentile(0.5) / 1e3) << ", \"p99\": " <<
+            json_number(result.latency.percentile(0.99) / 1e3) <<
+            ", \"p999\": " <<
+            json_number(result.latency.percentile(0.999) / 1e3) <<
+            ", \"max\": " << json_number(result.latency.maxValue() / 1e3) <<
+            "}}";
+    }
+    out << (metadata.empty() ? "]" : "\n  ]");
+    if (replay) {
+        out << ",\n  \"replay\": {\"streams\": " << replay->streams <<
+            ", \"reads\": " << replay->reads << ", \"writes\": " <<
+            replay->writes << ", \"syncs\": " << replay->syncs <<
+            ", \"readBytes\": " << replay->readBytes << ", \"writeBytes\": " <<
+            replay->writeBytes << ", \"lagUs\": " <<
+            json_number(replay->phase.lagNs / 1e3) << ",\n";
+        write_phase_json(out, "phase", replay->phase, replay->speed,
+            replay->iops, replay->writeBytes > 0);
+        out << "}";
+    }
+    out << "\n}\n";
 }
 
-void mm_write_file(const string &filename, vector<unsigned char> &buffer,
-    const size_t size_bytes) {
-    // MMap write test
-    // Open a file ans set zero size
-    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        perror("open");
-        throw string_view("mm_write_file/open");
+void write_csv(const string &path, const Config &config,
+    const vector<StepRecord> &records) {
+    ofstream out(path);
+    if (!out) {
+        throw invalid_argument("cannot write " + path);
+    }
+    out << "function,variant,size_bytes,buffer_size,block_size,jobs";
+    for (const char *phase : {"write", "read"}) {
+        for (const char *metric : {"mbps", "iops", "p50_us", "p99_us",
+            "p999_us", "max_us", "commit_p99_us", "major_faults",
+            "minor_faults", "cpu_ns_per_byte", "device_amplification"}) {
+            out << ',' << phase << '_' << metric;
+        }
     }
+    out << ",corrupt_blocks\n";
+    auto quoted = [](const string &str) {
+        string result = "\"";
+        for (char c : str) {
+            result += c == '"' ? string("\"\"") : string(1, c);
+        }
+        return result + '"';
+    };
+    out << setprecision(10);
+    for (const auto &record : records) {
+        const auto &step = record.result;
+        out << quoted(string(func_name(config.function))) << ',' <<
+            quoted(record.variant) << ',' << record.sizeBytes << ',' <<
+            record.bufferSize << ',' << (config.blockSize ? config.blockSize :
+            record.bufferSize) << ',' << config.jobs;
+        for (auto [phase, speed, iops, write] : {make_tuple(&step.write,
+            step.writeSpeed, step.writeIops, true), make_tuple(&step.read,
+            step.readSpeed, step.readIops, false)}) {
+            out << ',' << speed << ',' << iops << ',' <<
+                phase->latency.percentile(0.5) / 1e3 << ',' <<
+                phase->latency.percentile(0.99) / 1e3 << ',' <<
+                phase->latency.percentile(0.999) / 1e3 << ',' <<
+                phase->latency.maxValue() / 1e3 << ',' <<
+                phase->commit.percentile(0.99) / 1e3 << ',' <<
+                phase->usage.majorFaults << ',' << phase->usage.minorFaults <<
+                ',' << cpu_ns_per_byte(*phase) << ',' <<
+                device_amplification(*phase, write);
+        }
+        out << ',' << step.read.corruptBlocks << '\n';
+    }
+}
 
-    // Caching off
-    if (fcntl(fd, F_NOCACHE, 1) < 0) {
-        perror("fcntl F_NOCACHE");
-        throw string_view("mm_write_file/fcntl");
+// Minimal JSON reader for the baselines written by write_json
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0;
+    string str;
+    vector<JsonValue> items;  // array items or object values
+    vector<string> keys;      // object keys
+
+    const JsonValue *get(const string &key) const {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] == key) {
+                return &items[i];
+            }
+        }
+        return nullptr;
     }
+};
 
-    if (ftruncate(fd, size_bytes) != 0) {
-        perror("ftruncate");
-        close(fd);
-        throw string_view("mm_write_file/ftruncate");;
+class JsonParser {
+public:
+    explicit JsonParser(const string &text) : text_(text) {}
+
+    JsonValue parse() {
+        JsonValue value = parse_value();
+        skip_space();
+        if (pos_ != text_.size()) {
+            fail();
+        }
+        return value;
     }
-    // mmap
-    void* map = mmap(nullptr, size_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (map == MAP_FAILED) {
-        perror("mmap");
-        close(fd);
-        throw string_view("mm_write_file/mmap");;
+
+private:
+    [[noreturn]] void fail() {
+        throw invalid_argument("malformed JSON at offset " + to_string(pos_));
     }
-    size_t count = size_bytes / buffer.size();
-    // --- Write + msync ---
-    for (size_t i = 0; i < count; ++i) {
-        uint8_t* curr_p = static_cast<uint8_t*>(map) + i * buffer.size();
-        std::memcpy(curr_p, buffer.data(), buffer.size());
-        // Synchronizing
-        // it is possible to use MS_ASYNC
-        if (msync(curr_p, buffer.size(), MS_SYNC) != 0) {
-            perror("msync");
-            throw string_view("mm_write_file/msync");;
+
+    void skip_space() {
+        while (pos_ < text_.size() && isspace(static_cast<unsigned char>(
+            text_[pos_]))) {
+            ++pos_;
         }
     }
-    munmap(map, size_bytes);
-    close(fd);
-}
 
-uint8_t mm_read_file(const string &filename, vector<unsigned char> &buffer,
-    const size_t size_bytes) {
-    // --- MMap Read ---
-    // Open a file
-    int fd = open(filename.c_str(), O_RDONLY, 0644);
-    if (fd < 0) {
-        perror("open");
-        throw string_view("mm_write_file/open");;
+    void expect(char c) {
+        skip_space();
+        if (pos_ >= text_.size() || text_[pos_] != c) {
+            fail();
+        }
+        ++pos_;
     }
-    // Caching off
-    if (fcntl(fd, F_NOCACHE, 1) < 0) {
-        perror("fcntl F_NOCACHE");
-        throw string_view("mm_write_file/fcntl");
+
+    bool consume(const char *word) {
+        size_t len = strlen(word);
+        if (text_.compare(pos_, len, word) == 0) {
+            pos_ += len;
+            return true;
+        }
+        return false;
     }
-    // mmap
-    void* map = mmap(nullptr, size_bytes, PROT_READ, MAP_SHARED, fd, 0);
-    if (map == MAP_FAILED) {
-        perror("mmap");
-        close(fd);
-        throw string_view("mm_write_file/mmap");
+
+    // Skips the comma between the items of an array or object
+    bool next_item() {
+        skip_space();
+        if (pos_ < text_.size() && text_[pos_] == ',') {
+            ++pos_;
+            return true;
+        }
+        return false;
     }
-    size_t count = size_bytes / buffer.size();
-    uint8_t checksum = 0;
 
-    for (size_t i = 0; i < count; i++) {
-        uint8_t* ptr = static_cast<uint8_t*>(map) + i * buffer.size();
-        for (size_t j = 0; j < buffer.size(); j++) {
-            checksum ^= ptr[j];
+    string parse_string() {
+        expect('"');
+        string str;
+        while (pos_ < text_.size() && text_[pos_] != '"') {
+            char c = text_[pos_++];
+            if (c == '\\') {
+                if (pos_ >= text_.size()) {
+                    fail();
+                }
+                char e = text_[pos_++];
+                switch (e) {
+                case 'n': str += '\n'; break;
+                case 't': str += '\t'; break;
+                case 'r': str += '\r'; break;
+                case 'b': str += '\b'; break;
+                case 'f': str += '\f'; break;
+                case 'u':
+                    // the writer escapes control characters only
+                    if (pos_ + 4 > text_.size()) {
+                        fail();
+                    }
+                    str += static_cast<char>(stoi(text_.substr(pos_, 4),
+                        nullptr, 16));
+                    pos_ += 4;
+                    break;
+                default: str += e;
+                }
+            }
+            else {
+                str += c;
+            }
         }
+        expect('"');
+        return str;
     }
-    munmap(map, size_bytes);
-    close(fd);
-    return checksum;
+
+    JsonValue parse_value() {
+        skip_space();
+        if (pos_ >= text_.size()) {
+            fail();
+        }
+        JsonValue value;
+        char c = text_[pos_];
+        if (c == '{') {
+            value.type = JsonValue::Type::Object;
+            ++pos_;
+            skip_space();
+            if (pos_ < text_.size() && text_[pos_] == '}') {
+                ++pos_;
+                return value;
+            }
+            do {
+                value.keys.push_back(parse_string());
+                expect(':');
+                value.items.push_back(parse_value());
+            } while (next_item());
+            expect('}');
+        }
+        else if (c == '[') {
+            value.type = JsonValue::Type::Array;
+            ++pos_;
+            skip_space();
+            if (pos_ < text_.size() && text_[pos_] == ']') {
+                ++pos_;
+                return value;
+            }
+            do {
+                value.items.push_back(parse_value());
+            } while (next_item());
+            expect(']');
+        }
+        else if (c == '"') {
+            value.type = JsonValue::Type::String;
+            value.str = parse_string();
+        }
+        else if (consume("true")) {
+            value.type = JsonValue::Type::Bool;
+            value.boolean = true;
+        }
+        else if (consume("false")) {
+            value.type = JsonValue::Type::Bool;
+        }
+        else if (consume("null")) {
+            value.type = JsonValue::Type::Null;
+        }
+        else {
+            const char *begin = text_.c_str() + pos_;
+            char *end = nullptr;
+            value.type = JsonValue::Type::Number;
+            value.number = strtod(begin, &end);
+            if (end == begin) {
+                fail();
+            }
+            pos_ += end - begin;
+        }
+        return value;
+    }
+
+    const string &text_;
+    size_t pos_ = 0;
+};
+
+// Mean and sample variance
+pair<double, double> mean_variance(const vector<double> &samples) {
+    double mean = accumulate(samples.begin(), samples.end(), 0.0) /
+        samples.size();
+    double sum = 0;
+    for (double sample : samples) {
+        sum += (sample - mean) * (sample - mean);
+    }
+    return {mean, samples.size() > 1 ? sum / (samples.size() - 1) : 0};
 }
 
-void rw_write_file(const string &filename, vector<unsigned char> &buffer,
-    const size_t size_bytes) {
-    // ==== Write ====
-    int fd = open(filename.c_str(), O_CREAT | O_WRONLY, 0644);
-    if (fd < 0) {
-        perror("open write");
-        throw string_view("rw_write_file/open");
+// Two-sided 95% critical value of Student's t, Cornish-Fisher expansion
+double t_critical_95(double df) {
+    const double z = 1.959964;
+    return z + (z * z * z + z) / (4 * df) +
+        (5 * pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * df * df);
+}
+
+// Welch's t-test: whether the means of the samples differ at 95%
+bool significant_difference(const vector<double> &a, const vector<double> &b) {
+    if (a.size() < 2 || b.size() < 2) {
+        return true; // nothing to judge the noise by, the tolerance decides
+    }
+    auto [mean_a, var_a] = mean_variance(a);
+    auto [mean_b, var_b] = mean_variance(b);
+    double se_a = var_a / a.size();
+    double se_b = var_b / b.size();
+    if (se_a + se_b == 0) {
+        return mean_a != mean_b;
     }
+    double t = fabs(mean_a - mean_b) / sqrt(se_a + se_b);
+    double df = (se_a + se_b) * (se_a + se_b) / (se_a * se_a / (a.size() - 1) +
+        se_b * se_b / (b.size() - 1));
+    return t > t_critical_95(df);
+}
 
-    // Disable caching on macOS
-    fcntl(fd, F_NOCACHE, 1);
+JsonValue read_baseline(const string &path) {
+    ifstream in(path);
+    if (!in) {
+        throw invalid_argument("cannot read " + path);
+    }
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    JsonValue baseline = JsonParser(text).parse();
+    const JsonValue *steps = baseline.get("steps");
+    if (!steps || steps->type != JsonValue::Type::Array) {
+        throw invalid_argument(path + " has no steps");
+    }
+    return baseline;
+}
 
-    for (size_t written = 0; written < size_bytes; written += buffer.size()) {
-        if (write(fd, buffer.data(), buffer.size()) != buffer.size()) {
-            perror("write");
-            close(fd);
-            throw string_view("rw_write_file/write");
+// Refuse a baseline run with another function, buffer, block size, job count,
+// pattern or sync policy: its steps do not measure the same thing. Keys the
+// baseline does not have are not checked. Called before the run.
+void check_baseline(const Config &config) {
+    JsonValue baseline = read_baseline(config.comparePath);
+    const JsonValue *base = baseline.get("config");
+    if (!base) {
+        return;
+    }
+    string_view patterns[] = {"seq", "rand", "zipf", "hot"};
+    pair<const char *, string> strings[] = {
+        {"function", string(func_name(config.function))},
+        {"pattern", string(patterns[int(config.pattern)])},
+        {"sync", sync_label(config)}};
+    pair<const char *, double> numbers[] = {
+        {"bufferSize", double(config.bufferSize)},
+        {"blockSize", double(block_size(config))},
+        {"jobs", double(config.jobs)}};
+    string mismatches;
+    for (const auto &[key, value] : strings) {
+        const JsonValue *item = base->get(key);
+        if (item && item->type == JsonValue::Type::String && item->str != value) {
+            mismatches += string(", ") + key + " " + item->str + " (now " +
+                value + ")";
         }
     }
-    fsync(fd);
-    close(fd);
+    for (const auto &[key, value] : numbers) {
+        const JsonValue *item = base->get(key);
+        if (item && item->type == JsonValue::Type::Number &&
+            item->number != value) {
+            ostringstream text;
+            text << ", " << key << ' ' << item->number << " (now " << value << ')';
+            mismatches += text.str();
+        }
+    }
+    if (!mismatches.empty()) {
+        throw invalid_argument(config.comparePath + " was run with another "
+            "configuration: " + mismatches.substr(2));
+    }
 }
 
-unsigned char rw_read_file(const string &filename, vector<unsigned char> &buffer,
-const size_t size_bytes) {
-    // ==== Read ====
-    int fd = open(filename.c_str(), O_RDONLY);
-    if (fd < 0) {
-        perror("open read");
-        throw string_view("rw_read_file/open");
-    }
+// Compare the steps with a baseline JSON file. A throughput drop or a p99
+// latency rise beyond the tolerance is a regression when the samples show
+// it is not noise. Returns the number of regressions.
+int compare_baseline(const string &path, double tolerance,
+    const vector<StepRecord> &records) {
+    JsonValue baseline = read_baseline(path);
+    const JsonValue *steps = baseline.get("steps");
+    auto number = [](const JsonValue *object, const char *key) {
+        const JsonValue *value = object ? object->get(key) : nullptr;
+        return value && value->type == JsonValue::Type::Number ? value->number :
+            NAN;
+    };
+    auto samples = [](const JsonValue *object, const char *key) {
+        vector<double> values;
+        if (const JsonValue *array = object ? object->get(key) : nullptr) {
+            for (const auto &item : array->items) {
+                values.push_back(item.number);
+            }
+        }
+        return values;
+    };
 
-    fcntl(fd, F_NOCACHE, 1);
-    unsigned char sink = 0;
-    for (size_t read_bytes = 0; read_bytes < size_bytes;
-        read_bytes += buffer.size()) {
-        if (read(fd, buffer.data(), buffer.size()) != buffer.size()) {
-            perror("read");
-            close(fd);
-            throw string_view("rw_read_file/read");
+    int regressions = 0;
+    size_t compared = 0;
+    cout << "Comparison with " << path << " (tolerance " << tolerance <<
+        "%):\n";
+    for (const auto &record : records) {
+        const JsonValue *base = nullptr;
+        for (const auto &step : steps->items) {
+            const JsonValue *variant = step.get("variant");
+            double buffer_size = number(&step, "bufferSize");
+            if (number(&step, "sizeBytes") == record.sizeBytes && variant &&
+                variant->str == record.variant && (isnan(buffer_size) ||
+                buffer_size == record.bufferSize)) {
+                base = &step;
+            }
+        }
+        if (!base) {
+            continue;
+        }
+        ++compared;
+        for (auto [name, phase, speed] : {
+            make_tuple("write", &record.result.write, record.result.writeSpeed),
+            make_tuple("read", &record.result.read, record.result.readSpeed)}) {
+            const JsonValue *base_phase = base->get(name);
+            double base_speed = number(base_phase, "speed");
+            string label = (record.variant.empty() ? "" : record.variant +
+                ", ") + to_string(record.sizeBytes / (1 << 20)) + " MB, buffer " +
+                size_label(record.bufferSize) + ", " + name;
+            double change = (speed - base_speed) / base_speed * 100;
+            if (change < -tolerance &&
+                significant_difference(phase_samples(*phase),
+                samples(base_phase, "samples"))) {
+                cout << "  REGRESSION " << label << " speed: " << base_speed <<
+                    " -> " << speed << " MB/s (" << change << "%)\n";
+                ++regressions;
+            }
+            const JsonValue *latency = base_phase ?
+                base_phase->get("latencyUs") : nullptr;
+            double base_p99 = number(latency, "p99");
+            double p99 = phase->latency.percentile(0.99) / 1e3;
+            double rise = (p99 - base_p99) / base_p99 * 100;
+            if (base_p99 > 0 && rise > tolerance &&
+                significant_difference(latency_samples(*phase),
+                samples(base_phase, "p99Samples"))) {
+                cout << "  REGRESSION " << label << " p99 latency: " <<
+                    base_p99 << " -> " << p99 << " us (+" << rise << "%)\n";
+                ++regressions;
+            }
         }
-        sink ^= buffer[0];
     }
-    close(fd);
-    return sink;
+    cout << "  " << compared << " steps compared, " << regressions <<
+        " regressions\n";
+    return regressions;
 }
 
-void prw_write_file(const string &filename, vector<unsigned char> &buffer,
-    const size_t size_bytes) {
-    // ==== Write ====
-    int fd = open(filename.c_str(), O_CREAT | O_WRONLY, 0644);
-    if (fd < 0) {
-        perror("open write");
-        throw string_view("rw_write_file/open");
+// ---- Trials ----
+
+struct TrialSummary {
+    double median = 0;
+    double mean = 0;
+    double stddev = 0;
+    double ci = 0; // half-width of the 95% confidence interval of the mean
+};
+
+TrialSummary summarize(vector<double> values) {
+    TrialSummary summary;
+    sort(values.begin(), values.end());
+    size_t n = values.size();
+    summary.median = n % 2 ? values[n / 2] :
+        (values[n / 2 - 1] + values[n / 2]) / 2;
+    auto [mean, variance] = mean_variance(values);
+    summary.mean = mean;
+    summary.stddev = sqrt(variance);
+    if (n > 1) {
+        summary.ci = t_critical_95(n - 1) * summary.stddev / sqrt(double(n));
     }
+    return summary;
+}
 
-    // Disable caching on macOS
-    fcntl(fd, F_NOCACHE, 1);
+// Run the warmup and the trials of a size step. Trials repeat -trials times
+// and, with -ci or -budget, on until the confidence intervals of both speeds
+// are within the target or the time budget is spent. Returns the medians of
+// the speeds with the latencies and verification counts of all trials.
+StepResult run_trials(const Config &config, const string &mount_path,
+    size_t size_bytes, BufferArena &arena, vector<StepResult> &trials) {
+    for (int i = 0; i < config.warmup; ++i) {
+        run_step(config, mount_path, size_bytes, arena);
+    }
+    bool adaptive = config.ciTarget > 0 || config.budget > 0;
+    auto start = steady_clock::now();
+    while (true) {
+        trials.push_back(run_step(config, mount_path, size_bytes,
+            arena));
+        int done = trials.size();
+        if (done < config.trials) {
+            continue;
+        }
+        if (!adaptive || done >= MAX_TRIALS) {
+            break;
+        }
+        duration<double> elapsed = steady_clock::now() - start;
+        if (config.budget > 0 && elapsed.count() >= config.budget) {
+            break;
+        }
+        if (config.ciTarget > 0 && done > 1) {
+            vector<double> writes, reads;
+            for (const auto &trial : trials) {
+                writes.push_back(trial.writeSpeed);
+                reads.push_back(trial.readSpeed);
+            }
+            TrialSummary write = summarize(writes);
+            TrialSummary read = summarize(reads);
+            if (write.ci <= write.mean * config.ciTarget / 100 &&
+                read.ci <= read.mean * config.ciTarget / 100) {
+                break;
+            }
+        }
+    }
 
-    for (size_t offset = 0; offset < size_bytes; offset += buffer.size()) {
-        if (pwrite(fd, buffer.data(), buffer.size(), offset) != buffer.size()) {
-            perror("write");
-            close(fd);
-            throw string_view("rw_write_file/write");
+    StepResult step = trials.front();
+    if (trials.size() == 1) {
+        return step;
+    }
+    vector<double> write_speeds, read_speeds, write_iops, read_iops;
+    for (size_t i = 0; i < trials.size(); ++i) {
+        const auto &trial = trials[i];
+        write_speeds.push_back(trial.writeSpeed);
+        read_speeds.push_back(trial.readSpeed);
+        write_iops.push_back(trial.writeIops);
+        read_iops.push_back(trial.readIops);
+        step.write.trialP99.push_back(trial.write.latency.percentile(0.99) / 1e3);
+        step.read.trialP99.push_back(trial.read.latency.percentile(0.99) / 1e3);
+        if (i == 0) {
+            continue;
+        }
+        for (auto [merged, phase] : {make_pair(&step.write, &trial.write),
+            make_pair(&step.read, &trial.read)}) {
+            merged->latency.merge(phase->latency);
+            merged->commit.merge(phase->commit);
+            merged->verifiedBlocks += phase->verifiedBlocks;
+            merged->corruptBlocks += phase->corruptBlocks;
+            merged->usage += phase->usage;
+            add_perf(merged->perf, phase->perf, false);
+            merged->io += phase->io;
+            merged->trials = trials.size();
         }
     }
-    fsync(fd);
-    close(fd);
+    step.write.trialSpeeds = write_speeds;
+    step.read.trialSpeeds = read_speeds;
+    step.writeSpeed = summarize(write_speeds).median;
+    step.readSpeed = summarize(read_speeds).median;
+    step.writeIops = summarize(write_iops).median;
+    step.readIops = summarize(read_iops).median;
+    return step;
 }
 
-unsigned char prw_read_file(const string &filename, vector<unsigned char> &buffer,
-        const size_t size_bytes) {
-    // ==== Read ====
-    int fd = open(filename.c_str(), O_RDONLY);
-    if (fd < 0) {
-        perror("open read");
-        throw string_view("rw_read_file/open");
+void print_trials(const Config &config, const vector<StepResult> &trials) {
+    if (trials.size() < 2) {
+        return;
     }
+    cout << "  Trials: " << trials.size();
+    if (config.warmup) {
+        cout << " (+" << config.warmup << " warmup)";
+    }
+    cout << '\n';
+    auto print_metric = [&](const char *name, auto metric) {
+        vector<double> values;
+        for (const auto &trial : trials) {
+            values.push_back(metric(trial));
+        }
+        TrialSummary summary = summarize(values);
+        cout << "    " << name << ": median " << summary.median << ", stddev " <<
+            summary.stddev << ", 95% CI +-" << summary.ci << " (" <<
+            summary.ci / summary.mean * 100 << "%)\n";
+    };
+    print_metric("Write MB/s", [](const StepResult &r) { return r.writeSpeed; });
+    print_metric("Read MB/s", [](const StepResult &r) { return r.readSpeed; });
+    print_metric("Write IOPS", [](const StepResult &r) { return r.writeIops; });
+    print_metric("Read IOPS", [](const StepResult &r) { return r.readIops; });
+    print_metric("Write p99, us", [](const StepResult &r) {
+        return r.write.latency.percentile(0.99) / 1e3; });
+    print_metric("Read p99, us", [](const StepResult &r) {
+        return r.read.latency.percentile(0.99) / 1e3; });
+}
 
-    fcntl(fd, F_NOCACHE, 1);
-    unsigned char sink = 0;
-    for (size_t offset = 0; offset < size_bytes;
-        offset += buffer.size()) {
-        if (pread(fd, buffer.data(), buffer.size(), offset) != buffer.size()) {
-            perror("read");
-            close(fd);
-            throw string_view("rw_read_file/read");
+// ---- Block size sweep ----
+// Buffer sizes of the run: -buf=lo..hi doubles the size from lo up to hi
+vector<size_t> buffer_sizes(const Config &config) {
+    vector<size_t> sizes{config.bufferSize};
+    while (config.bufferMax && sizes.back() * 2 <= config.bufferMax) {
+        sizes.push_back(sizes.back() * 2);
+    }
+    return sizes;
+}
+
+// Smallest block size whose speed, averaged over the file sizes, comes
+// within 90% of the best one
+size_t knee_block_size(const vector<size_t> &blocks,
+    const vector<vector<double>> &grid) {
+    vector<double> means(blocks.size());
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        for (const auto &row : grid) {
+            means[b] += row[b] / grid.size();
         }
-        sink ^= buffer[0];
     }
-    close(fd);
-    return sink;
+    double best = *max_element(means.begin(), means.end());
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (means[b] >= 0.9 * best) {
+            return blocks[b];
+        }
+    }
+    return blocks.back();
 }
 
-void cleanup(vector<string>& filenames) {
-    for (const auto &filename : filenames) {
-        unlink(filename.c_str());
+// File size x block size throughput grids of every variant of a sweep
+void print_grids(const Config &config, const vector<StepRecord> &records) {
+    vector<size_t> blocks = buffer_sizes(config);
+    vector<string> variants;
+    for (const auto &record : records) {
+        if (find(variants.begin(), variants.end(), record.variant) ==
+            variants.end()) {
+            variants.push_back(record.variant);
+        }
+    }
+    for (size_t v = 0; v < variants.size(); ++v) {
+        vector<size_t> sizes;
+        vector<vector<double>> write_grid, read_grid;
+        for (const auto &record : records) {
+            if (record.variant != variants[v]) {
+                continue;
+            }
+            if (sizes.empty() || sizes.back() != record.sizeBytes) {
+                sizes.push_back(record.sizeBytes);
+                write_grid.emplace_back(blocks.size());
+                read_grid.emplace_back(blocks.size());
+            }
+            size_t b = find(blocks.begin(), blocks.end(), record.bufferSize) -
+                blocks.begin();
+            write_grid.back()[b] = record.result.writeSpeed;
+            read_grid.back()[b] = record.result.readSpeed;
+        }
+        cout << func_name(config.function) << (variants[v].empty() ? "" : ", ") <<
+            variants[v] << '\n';
+        for (auto [phase, grid] : {make_pair("Write", &write_grid),
+            make_pair("Read", &read_grid)}) {
+            cout << "  " << phase << " MB/s, file size x block size:\n" <<
+                setw(10) << "";
+            for (size_t block : blocks) {
+                cout << setw(10) << size_label(block);
+            }
+            cout << '\n';
+            for (size_t i = 0; i < sizes.size(); ++i) {
+                cout << setw(10) << size_label(sizes[i]);
+                for (double speed : (*grid)[i]) {
+                    cout << setw(10) << static_cast<long>(speed);
+                }
+                cout << '\n';
+            }
+            cout << "  " << phase << " knee block size: " <<
+                size_label(knee_block_size(blocks, *grid)) << '\n';
+            if (config.plotGraph) {
+                string filename = string("heatmap_") + (phase[0] == 'W' ?
+                    "write" : "read") + (variants.size() > 1 ? "_" +
+                    to_string(v) : "") + ".svg";
+                plotHeatmap(*grid, sizes, blocks, string(phase) + " speed (MB/s)",
+                    filename);
+                cout << "The heatmap saved in " << filename << endl;
+            }
+        }
     }
 }
 
-string_view func_name(Func func) {
-    switch(func) {
-        case Func::ReadWrite: return "read/write";
-        case Func::PReadWrite: return "pread/pwrite";
-        case Func::FStream: return "fstream";
-        case Func::MMap: return "mmap";
+// Buffer, block and file sizes the engines can work with
+void check_io_sizes(const Config &config, size_t alignment) {
+    if (config.directIO && (config.bufferSize % alignment != 0 ||
+        block_size(config) % alignment != 0)) {
+        throw invalid_argument("buffer size must be a multiple of the "
+            "device block size (" + to_string(alignment) + " B) for direct I/O");
+    }
+    // the kernel checks every iovec of a direct transfer
+    if (config.function == Func::PReadWriteV) {
+        size_t block = block_size(config);
+        if (config.iovSizes.empty() && block % config.iovCount != 0) {
+            throw invalid_argument("block size must be a multiple of the "
+                "iovec count");
+        }
+        size_t iov_size = block / config.iovCount;
+        for (size_t size : config.iovSizes.empty() ?
+            vector<size_t>{iov_size} : config.iovSizes) {
+            if (config.directIO && size % alignment != 0) {
+                throw invalid_argument("iovec sizes must be multiples of the "
+                    "device block size (" + to_string(alignment) +
+                    " B) for direct I/O");
+            }
+        }
+    }
+    if (block_size(config) > config.minSize) {
+        throw invalid_argument("block size cannot be greater than minSize");
+    }
+    // the engines stamp whole blocks
+    if (config.verify && (block_size(config) < sizeof(BlockHeader) ||
+        config.minSize % block_size(config) != 0 ||
+        config.strideSize % block_size(config) != 0)) {
+        throw invalid_argument("with verification the sizes must be "
+            "multiples of the I/O size");
     }
 }
 
 int main(int argc, char *argv[]) {
     try {
         Config config = parseArgs(argc, argv);
+        if (!config.convertText.empty()) {
+            size_t count = convert_trace(config.convertText,
+                config.convertTrace);
+            cout << count << " records written to " << config.convertTrace <<
+                endl;
+            return 0;
+        }
+        if (!config.comparePath.empty()) {
+            check_baseline(config);
+        }
         string_view no_yes[] = {"no", "yes"};
         cout << "Configuration:\n";
         cout << "  Functoins:     " << func_name(config.function) << '\n';
@@ -574,14 +6458,80 @@ int main(int argc, char *argv[]) {
         cout << "  Stride size:   " << formatSize(config.strideSize) << '\n';
         cout << "  Memory buffer: " << formatSize(config.bufferSize) << '\n';
         cout << "  Iterations:    " << config.iterations << '\n';
-        cout << "  Use RAM disk:  " << no_yes[config.useRamDisk] << '\n';
+        if (config.trials > 1 || config.warmup || config.ciTarget ||
+            config.budget) {
+            cout << "  Trials:        " << config.trials << " (warmup " <<
+                config.warmup << ")";
+            if (config.ciTarget) {
+                cout << ", until 95% CI within " << config.ciTarget << "%";
+            }
+            if (config.budget) {
+                cout << ", budget " << config.budget << " s";
+            }
+            cout << '\n';
+        }
+        if (config.function == Func::PReadWrite ||
+            config.function == Func::PReadWriteV ||
+            config.function == Func::MMap || config.function == Func::Uring) {
+            string_view patterns[] = {"sequential", "random", "zipf", "hotspot"};
+            cout << "  Pattern:       " << patterns[int(config.pattern)] << '\n';
+            cout << "  Block size:    " << formatSize(block_size(config)) << '\n';
+        }
+        cout << "  Jobs:          " << config.jobs <<
+            (config.sharedFile ? " (shared file)" : "") << '\n';
+        if (!config.cpus.empty()) {
+            cout << "  CPUs:          ";
+            for (size_t i = 0; i < config.cpus.size(); ++i) {
+                cout << (i ? "," : "") << config.cpus[i];
+            }
+            cout << '\n';
+        }
+        if (config.hugepages != Hugepages::Off) {
+            cout << "  Huge pages:    " << hugepagesName(config.hugepages) << '\n';
+        }
+        cout << "  Data:          " << data_label(config.data) << '\n';
+        cout << "  Use RAM disk:  " << no_yes[config.useRamDisk] <<
+            (config.hugeRamDisk ? " (hugetlbfs)" : "") << '\n';
         cout << "  Plot graph:    " << no_yes[config.plotGraph] << '\n';
+        cout << "  Direct I/O:    " << no_yes[config.directIO] << '\n';
+        cout << "  Layout:        " << layoutName(config.layout) << '\n';
+        if (config.function == Func::MMap && config.mmapSweep.size() == 1) {
+            cout << "  mmap options:  " << mmapPolicyName(config.mmap) << '\n';
+        }
+        if (config.syncSweep.size() == 1) {
+            cout << "  Sync policy:   " << syncPolicyName(config.sync) << '\n';
+        }
+        if (config.function == Func::PReadWriteV) {
+            cout << "  iovecs:        " << config.iovCount << '\n';
+            string flags;
+#ifdef HAVE_PREADV2
+            pair<int, string_view> names[] = {{RWF_NOWAIT, "nowait"},
+                {RWF_HIPRI, "hipri"}, {RWF_DSYNC, "dsync"}, {RWF_SYNC, "sync"}};
+            for (const auto &[flag, name] : names) {
+                if (config.rwFlags & flag) {
+                    flags += (flags.empty() ? "" : ",") + string(name);
+                }
+            }
+#endif
+            cout << "  RWF flags:     " << (flags.empty() ? "none" : flags) << '\n';
+        }
+        if (config.function == Func::Uring) {
+            cout << "  Queue depth:   " << config.queueDepth << '\n';
+            cout << "  Fixed buffers: " << no_yes[config.uringFixed] << '\n';
+            cout << "  SQ polling:    " << no_yes[config.uringSqpoll] << '\n';
+        }
 
         bool verbose = false;
         // if RAM disk is enabled, mount RAM disk
         string mount_path;
         if (config.useRamDisk) {
+#ifdef __APPLE__
             int err = create_ramdisk(verbose);
+            mount_path = MOUNT_PATH;
+#else
+            int err = create_memory_ramdisk(verbose, config.hugeRamDisk,
+                mount_path);
+#endif
             switch (err) {
             case FAILED_CREATE: // Failed to create RAM disk device
                 cerr << "Failed to create RAM disk device!" << endl;
@@ -590,112 +6540,246 @@ int main(int argc, char *argv[]) {
                 cerr << "Failed to mount RAM disk!" << endl;
                 return 1;
             case DISK_NOT_FOUND: // RAM disk not found in /Volumes
+#ifdef __APPLE__
                 cerr << "RAM disk not found in /Volumes!" << endl;
+#else
+                cerr << "No writable " << (config.hugeRamDisk ? "hugetlbfs" :
+                    RAMDISK_TMPFS) << " mount found!" << endl;
+#endif
                 return 1;
             }
-            mount_path = MOUNT_PATH;
         }
         else {
             mount_path = ".";
         }
         // RAM disk mounted
         //---------------------------------------
+        size_t alignment = direct_io_alignment(mount_path);
+        for (size_t buffer_size : buffer_sizes(config)) {
+            Config sized = config;
+            sized.bufferSize = buffer_size;
+            check_io_sizes(sized, alignment);
+        }
+        // the jobs pin themselves to one CPU each, the rest of the process
+        // stays within the set
+        if (!config.cpus.empty()) {
+            pin_thread(config.cpus);
+        }
+        // one allocation for the buffers and write data of the whole run
+        size_t slot_size = 0;
+        for (size_t buffer_size : buffer_sizes(config)) {
+            Config sized = config;
+            sized.bufferSize = buffer_size;
+            slot_size = max(slot_size, data_pool_size(sized));
+        }
+        BufferArena arena(config.jobs, slot_size, max(alignment,
+            static_cast<size_t>(sysconf(_SC_PAGESIZE))), config.hugepages);
+        int device_node = device_numa_node(mount_path);
+        if (!config.numaSweep.empty()) {
+            cout << "Device NUMA node: " << (device_node < 0 ? "unknown" :
+                to_string(device_node)) << '\n';
+        }
+
+        uint64_t corrupt_blocks = 0;
+        vector<StepRecord> records;
         vector<double> sizes_mb;
         vector<double> write_speeds;
         vector<double> read_speeds;
 
-        auto test_write = array<function<void(const string&,
-        vector<unsigned char>&, const size_t)>, 4>{rw_write_file, prw_write_file, fs_write_file,
-            mm_write_file}[int(config.function)];
-
-        auto test_read = array<function<uint8_t(const string&,
-            vector<unsigned char>&, const size_t)>, 4>{rw_read_file, prw_read_file, fs_read_file,
-                mm_read_file}[int(config.function)];
+        // the configurations to run at every size step
+        vector<Config> variants;
+        vector<int> numa_nodes = config.numaSweep;
+        if (numa_nodes.empty()) {
+            numa_nodes.push_back(-1);
+        }
+        for (int node : numa_nodes) {
+            for (const auto &policy : config.mmapSweep) {
+                for (const auto &sync : config.syncSweep) {
+                    for (size_t buffer_size : buffer_sizes(config)) {
+                        variants.push_back(config);
+                        variants.back().numaNode = node;
+                        variants.back().mmap = policy;
+                        variants.back().sync = sync;
+                        variants.back().bufferSize = buffer_size;
+                    }
+                }
+            }
+        }
 
-        for (size_t size_bytes = config.minSize; size_bytes <= config.maxSize;
-            size_bytes += config.strideSize) {
-                vector<string> filenames;
-                filenames.reserve(config.iterations);
+        // the metadata workload or a trace replay replaces the size steps
+        vector<MetaResult> metadata;
+        unique_ptr<ReplayResult> replay;
+        unique_ptr<TraceWriter> trace;
+        if (!config.recordPath.empty()) {
+            trace = make_unique<TraceWriter>(config.recordPath);
+        }
+        if (!config.replayPath.empty()) {
+            if (!config.numaSweep.empty()) {
+                arena.place(config.numaSweep.front());
+            }
+            replay = make_unique<ReplayResult>(run_replay(config, mount_path,
+                arena));
+            print_replay(config, *replay);
+        }
+        else if (config.metaFiles) {
+            try {
+                if (!config.numaSweep.empty()) {
+                    arena.place(config.numaSweep.front());
+                }
+                metadata = run_metadata(config, mount_path, arena);
+            }
+            catch (string_view msg) {
+                cout << "Error ocuured at " << msg << endl;
+                return 1;
+            }
+            print_metadata(config, metadata);
+        }
+        else {
+            for (size_t size_bytes = config.minSize; size_bytes <= config.maxSize;
+                size_bytes += config.strideSize) {
                 size_t size_mb = size_bytes / (1 << 20);
-                time_point<high_resolution_clock> end_write,
-                    start_write,
-                    end_read,
-                    start_read;
-                try
-                {
-                    // Write test
-                    vector<unsigned char> wr_buffer(config.bufferSize);
-                    memset(wr_buffer.data(), 0x55, config.bufferSize);
-                    start_write = high_resolution_clock::now();
-                    try {
-                        for (int i = 0; i < config.iterations; ++i) {
-                            string filename = mount_path + "/testfile_" + to_string(i) +
-                            ".bin";
-                            cout << "filename: " << filename << "\n";
-                            test_write(filename, wr_buffer, size_bytes);
-                            filenames.push_back(filename);
+                for (const auto &variant : variants) {
+                    if (variant.numaNode >= 0) {
+                        arena.place(variant.numaNode);
+                        int node = arena.node();
+                        cout << "numa: buffers on node " << (node < 0 ? "unknown" :
+                            to_string(node));
+                        if (device_node >= 0 && node >= 0) {
+                            cout << (node == device_node ? " (local" : " (remote") <<
+                                " to the device)";
                         }
+                        cout << '\n';
                     }
-                    catch (string_view msg) {
-                        cout << "Error ocuured at " << msg << endl;
-                        throw 0;
+                    if (config.mmapSweep.size() > 1) {
+                        cout << "mmap: " << mmapPolicyName(variant.mmap) << '\n';
                     }
-                    end_write = high_resolution_clock::now();
-
-                    // Read test
-                    vector<unsigned char> rd_buffer(config.bufferSize);
-
-                    unsigned char sink = 0;
-                    start_read = high_resolution_clock::now();
-                    for (const auto &filename : filenames) {
-                        // to prevent an optimization
-                        sink ^= test_read(filename, rd_buffer, size_bytes);
+                    if (config.syncSweep.size() > 1) {
+                        cout << "sync: " << syncPolicyName(variant.sync) << '\n';
+                    }
+                    if (config.bufferMax) {
+                        cout << "buffer: " << size_label(variant.bufferSize) <<
+                            '\n';
+                    }
+                    vector<StepResult> trials;
+                    StepResult step = run_trials(variant, mount_path, size_bytes,
+                        arena, trials);
+                    print_step(variant, size_bytes, step);
+                    print_trials(variant, trials);
+                    corrupt_blocks += step.read.corruptBlocks;
+                    if (trace) {
+                        for (auto &trial : trials) {
+                            trace->append(move(trial.write.trace));
+                            trace->append(move(trial.read.trace));
+                        }
+                        step.write.trace.clear();
+                        step.read.trace.clear();
+                    }
+                    records.push_back({variant_name(variant), size_bytes,
+                        variant.bufferSize, step});
+                    if (config.plotGraph && config.sampleMs) {
+                        string filename = "timeline_" + to_string(size_mb) + "MB";
+                        if (variants.size() > 1) {
+                            filename += "_" + to_string(&variant - &variants[0]);
+                        }
+                        filename += ".svg";
+                        plotTimeline(timeline_speeds(step.write),
+                            timeline_speeds(step.read), filename);
+                        cout << "The timeline saved in " << filename << endl;
+                    }
+                    if (config.plotGraph && !step.rates.empty()) {
+                        string filename = "rate_curve_" + to_string(size_mb) +
+                            "MB";
+                        if (variants.size() > 1) {
+                            filename += "_" + to_string(&variant - &variants[0]);
+                        }
+                        filename += ".svg";
+                        vector<PlotSeries> curves = {{"Write p50", "salmon", {}, {}},
+                            {"Write p99", "red", {}, {}},
+                            {"Read p50", "lightblue", {}, {}},
+                            {"Read p99", "blue", {}, {}}};
+                        for (const auto &rate : step.rates) {
+                            for (int c = 0; c < 4; ++c) {
+                                const auto &rated = c < 2 ? rate.write : rate.read;
+                                curves[c].x.push_back(rated.speed);
+                                curves[c].y.push_back(rated.latency.percentile(
+                                    c % 2 ? 0.99 : 0.5) / 1e3);
+                            }
+                        }
+                        plotRateCurve(curves, filename);
+                        cout << "The latency curve saved in " << filename << endl;
+                    }
+                    // the plot shows the first variant
+                    if (&variant == &variants.front()) {
+                        sizes_mb.push_back(static_cast<double>(size_mb));
+                        write_speeds.push_back(step.writeSpeed);
+                        read_speeds.push_back(step.readSpeed);
                     }
-                    end_read = high_resolution_clock::now();
-                    cout << "sink = " << (int)sink << endl;
-                }
-                catch (...) {
-                    cleanup(filenames);
-                    exit(1);
                 }
-            cleanup(filenames);
-
-            duration<double> write_duration = end_write - start_write;
-            duration<double> read_duration = end_read - start_read;
-
-            double total_mb = static_cast<double>(size_mb * config.iterations);
-            double write_speed = total_mb / write_duration.count();
-            double read_speed = total_mb / read_duration.count();
-
-            sizes_mb.push_back(static_cast<double>(size_mb));
-            write_speeds.push_back(write_speed);
-            read_speeds.push_back(read_speed);
+            }
+        }
 
-            cout << "Size: " << size_mb << " MB | Write: " << write_speed <<
-            " MB/s | Read: " << read_speed << " MB/s\n";
+        if (trace) {
+            cout << "The trace of " << trace->count() << " operations saved in " <<
+                config.recordPath << endl;
+        }
+        if (config.bufferMax) {
+            print_grids(config, records);
         }
 
-        if (config.plotGraph) {
-            string filename("speed_graph.png");
+        if (config.plotGraph && !sizes_mb.empty()) {
+            string filename("speed_graph.svg");
             plotGraph(sizes_mb, write_speeds, read_speeds, filename);
             cout << "The plot saved in " << filename << endl;
         }
 
+        if (!config.jsonPath.empty()) {
+            write_json(config.jsonPath, config, system_info(mount_path),
+                records, metadata, replay.get());
+            cout << "The results saved in " << config.jsonPath << endl;
+        }
+        if (!config.csvPath.empty()) {
+            write_csv(config.csvPath, config, records);
+            cout << "The results saved in " << config.csvPath << endl;
+        }
+        int regressions = 0;
+        if (!config.comparePath.empty()) {
+            regressions = compare_baseline(config.comparePath,
+                config.tolerance, records);
+        }
+
         if (config.useRamDisk) {
+#ifdef __APPLE__
             int err = unmount_ramdisk(verbose);
+#else
+            int err = remove_memory_ramdisk(verbose, mount_path);
+#endif
             switch (err) {
             case ERROR_EJECTING: // Error ejecting RAM disk
                 cerr << "Error ejecting RAM disk" << endl;
                 return 1;
             case RAMDISK_STILL_EXISTS: // RAM disk still exists in /Volumes
-                cerr << "RAM disk still exists in /Volumes" << endl;
+                cerr << "RAM disk still exists in " << mount_path << endl;
                 return 1;
             }
         }
+        if (corrupt_blocks) {
+            cerr << "Data verification failed: " << corrupt_blocks <<
+                " corrupt blocks" << endl;
+            return 1;
+        }
+        if (regressions) {
+            cerr << "Performance regressions against " << config.comparePath <<
+                ": " << regressions << endl;
+            return 1;
+        }
     }
     catch (const exception &e) {
         cerr << "Error: " << e.what() << '\n';
         return 1;
     }
+    catch (string_view msg) {
+        cerr << "Error occurred at " << msg << '\n';
+        return 1;
+    }
     return 0;
 }